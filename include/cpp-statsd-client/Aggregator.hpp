@@ -0,0 +1,170 @@
+#ifndef AGGREGATOR_HPP
+#define AGGREGATOR_HPP
+
+#include <cpp-statsd-client/Formatter.hpp>
+#include <cpp-statsd-client/Random.hpp>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace Statsd {
+
+/*!
+ *
+ * Aggregator
+ *
+ * Keeps an in-process table of counters and gauges so that each distinct
+ * metric is emitted at most once per flush. Counters are summed and gauges
+ * keep the last written value.
+ *
+ * A metric is identified by its serialized line without the value, i.e.
+ * "prefix.key|type|#tags", which covers the prefixed key, the type and the
+ * tags at once. The length of the "prefix.key" part is kept alongside so
+ * the value can be spliced back in when emitting "prefix.key:value|type|#tags".
+ *
+ * The table is split into stripes picked by the thread index, each with
+ * its own lock, so that threads aggregating at once seldom wait on each
+ * other, even on the same metric. The stripes are merged at the flush,
+ * where the gauge written last wins, as told by a sequence number.
+ *
+ */
+class Aggregator final {
+public:
+    //!@name Methods
+    //!@{
+
+    //! Adds a delta to the counter identified by the serialized metric
+    void count(const std::string& metric, const std::size_t nameLength, const int64_t delta) noexcept;
+
+    //! Sets the value of the gauge identified by the serialized metric
+    void gauge(const std::string& metric, const std::size_t nameLength, const std::string& value) noexcept;
+
+    //! Hands every aggregated line to the sink and resets the table
+    template <typename Sink>
+    void flush(Sink&& sink) noexcept;
+
+    //!@}
+
+private:
+    //! An aggregated metric
+    struct Entry {
+        //! The length of the "prefix.key" part of the serialized metric
+        std::size_t nameLength;
+
+        //! The sum of the deltas, for counters
+        int64_t count;
+
+        //! The last formatted value, for gauges
+        std::string value;
+
+        //! When the gauge value was written, for gauges
+        uint64_t sequence;
+
+        //! Whether the value is the count or the gauge value
+        bool isCounter;
+    };
+
+    //! The aggregated metrics, keyed by serialized metric
+    using Table = std::unordered_map<std::string, Entry>;
+
+    //! The number of stripes
+    static constexpr std::size_t k_stripes{16};
+
+    //! A stripe of the table, padded so that the locks of neighbouring stripes do not share a cache line
+    struct Stripe {
+        //! The aggregated metrics of the stripe
+        Table entries;
+
+        //! The mutex guarding them
+        std::mutex mutex;
+
+        char padding[64];
+    };
+
+    //! Returns the stripe of the calling thread
+    Stripe& stripe() noexcept;
+
+    //! The stripes
+    Stripe m_stripes[k_stripes];
+
+    //! The sequence number of the next gauge value
+    std::atomic<uint64_t> m_sequence{0};
+};
+
+inline Aggregator::Stripe& Aggregator::stripe() noexcept {
+    return m_stripes[detail::threadIndex() % k_stripes];
+}
+
+inline void Aggregator::count(const std::string& metric, const std::size_t nameLength, const int64_t delta) noexcept {
+    auto& stripe = this->stripe();
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    auto it = stripe.entries.find(metric);
+    if (it == stripe.entries.end()) {
+        it = stripe.entries.emplace(metric, Entry{nameLength, 0, std::string(), 0, true}).first;
+    }
+    it->second.count += delta;
+}
+
+inline void Aggregator::gauge(const std::string& metric,
+                              const std::size_t nameLength,
+                              const std::string& value) noexcept {
+    auto& stripe = this->stripe();
+    const uint64_t sequence = m_sequence.fetch_add(1, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    auto it = stripe.entries.find(metric);
+    if (it == stripe.entries.end()) {
+        it = stripe.entries.emplace(metric, Entry{nameLength, 0, std::string(), 0, false}).first;
+    }
+    it->second.value = value;
+    it->second.sequence = sequence;
+}
+
+template <typename Sink>
+inline void Aggregator::flush(Sink&& sink) noexcept {
+    // Swap the stripes out one at a time so that producers are only blocked for the swap, then merge them
+    Table staged;
+    for (auto& stripe : m_stripes) {
+        Table entries;
+        std::unique_lock<std::mutex> lock(stripe.mutex);
+        stripe.entries.swap(entries);
+        lock.unlock();
+
+        if (staged.empty()) {
+            staged.swap(entries);
+            continue;
+        }
+        for (auto& entry : entries) {
+            const auto merged = staged.insert(entry);
+            auto& kept = merged.first->second;
+            if (merged.second) {
+                continue;
+            }
+            if (entry.second.isCounter) {
+                kept.count += entry.second.count;
+            } else if (entry.second.sequence > kept.sequence) {
+                kept.value.swap(entry.second.value);
+                kept.sequence = entry.second.sequence;
+            }
+        }
+    }
+
+    // Splice the values back into the serialized metrics
+    std::string line;
+    for (const auto& entry : staged) {
+        line.assign(entry.first, 0, entry.second.nameLength);
+        line.push_back(':');
+        if (entry.second.isCounter) {
+            detail::appendInteger(line, entry.second.count);
+        } else {
+            line.append(entry.second.value);
+        }
+        line.append(entry.first, entry.second.nameLength, std::string::npos);
+        sink(line);
+    }
+}
+
+}  // namespace Statsd
+
+#endif
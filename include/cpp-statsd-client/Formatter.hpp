@@ -0,0 +1,263 @@
+#ifndef FORMATTER_HPP
+#define FORMATTER_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <type_traits>
+
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<charconv>)
+#include <charconv>
+#endif
+#endif
+
+namespace Statsd {
+namespace detail {
+
+/*!
+ *
+ * Value formatting
+ *
+ * Metric values are appended straight to the message buffer,
+ * without the locale lookups and the allocations of a stream.
+ *
+ * Integers are written as is. Floating point numbers are written
+ * with a fixed precision, the way std::fixed << std::setprecision
+ * would. std::to_chars is used when the standard library provides
+ * it, otherwise the value is scaled to an integer which is rounded
+ * the way printf does. Any other type is formatted through a stream.
+ *
+ * Sample rates are written with as many decimals as it takes to read
+ * them back as the same float, so that a rate in (0, 1) never comes
+ * out as 0 or 1.
+ *
+ */
+
+//! The categories of values, selecting how they are formatted
+using IntegerValue = std::integral_constant<int, 0>;
+using FloatingPointValue = std::integral_constant<int, 1>;
+using StreamedValue = std::integral_constant<int, 2>;
+
+//! Characters are streamed as characters, not as numbers
+template <typename T>
+struct IsCharacter
+    : std::integral_constant<bool,
+                             std::is_same<T, char>::value || std::is_same<T, signed char>::value ||
+                                 std::is_same<T, unsigned char>::value || std::is_same<T, wchar_t>::value ||
+                                 std::is_same<T, char16_t>::value || std::is_same<T, char32_t>::value> {};
+
+template <typename T>
+using ValueCategory = typename std::conditional<
+    std::is_integral<T>::value && !IsCharacter<T>::value,
+    IntegerValue,
+    typename std::conditional<std::is_floating_point<T>::value, FloatingPointValue, StreamedValue>::type>::type;
+
+//! Append the decimal digits of an unsigned integer
+inline void appendDigits(std::string& buffer, uint64_t value) {
+    char digits[20];
+    char* first = digits + sizeof(digits);
+    do {
+        *--first = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    buffer.append(first, static_cast<std::size_t>(digits + sizeof(digits) - first));
+}
+
+//! Append an unsigned integer
+inline void appendInteger(std::string& buffer, const uint64_t value, std::false_type) {
+#if defined(__cpp_lib_to_chars)
+    char digits[20];
+    const auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    buffer.append(digits, static_cast<std::size_t>(result.ptr - digits));
+#else
+    appendDigits(buffer, value);
+#endif
+}
+
+//! Append a signed integer
+inline void appendInteger(std::string& buffer, const int64_t value, std::true_type) {
+    if (value < 0) {
+        buffer.push_back('-');
+    }
+    // Negate in the unsigned domain so that the minimum value does not overflow
+    const uint64_t magnitude = static_cast<uint64_t>(value);
+    appendInteger(buffer, value < 0 ? 0 - magnitude : magnitude, std::false_type());
+}
+
+//! Append an integer
+template <typename T>
+inline void appendInteger(std::string& buffer, const T value) {
+    using Signed = std::integral_constant<bool, std::is_signed<T>::value>;
+    using Widened = typename std::conditional<Signed::value, int64_t, uint64_t>::type;
+    appendInteger(buffer, static_cast<Widened>(value), Signed());
+}
+
+//! Append a floating point number with a fixed number of decimals, through printf for the odd cases
+inline void appendFixedFallback(std::string& buffer, const double value, const int precision) {
+    const int length = std::snprintf(nullptr, 0, "%.*f", precision, value);
+    if (length <= 0) {
+        return;
+    }
+    const std::size_t offset = buffer.size();
+    buffer.resize(offset + static_cast<std::size_t>(length) + 1);
+    std::snprintf(&buffer[offset], static_cast<std::size_t>(length) + 1, "%.*f", precision, value);
+    buffer.resize(offset + static_cast<std::size_t>(length));
+}
+
+//! Append a floating point number with a fixed number of decimals
+inline void appendFixed(std::string& buffer, const double value, int precision) {
+    // Streams fall back to the default precision when given a negative one
+    if (precision < 0) {
+        precision = 6;
+    }
+
+#if defined(__cpp_lib_to_chars)
+    char digits[64];
+    const auto result = std::to_chars(digits, digits + sizeof(digits), value, std::chars_format::fixed, precision);
+    if (result.ec == std::errc()) {
+        buffer.append(digits, static_cast<std::size_t>(result.ptr - digits));
+        return;
+    }
+#else
+    static constexpr uint64_t powersOfTen[] = {1ull,
+                                               10ull,
+                                               100ull,
+                                               1000ull,
+                                               10000ull,
+                                               100000ull,
+                                               1000000ull,
+                                               10000000ull,
+                                               100000000ull,
+                                               1000000000ull,
+                                               10000000000ull,
+                                               100000000000ull,
+                                               1000000000000ull,
+                                               10000000000000ull,
+                                               100000000000000ull,
+                                               1000000000000000ull};
+    constexpr int maxPrecision = static_cast<int>(sizeof(powersOfTen) / sizeof(powersOfTen[0])) - 1;
+
+    // Scale the value to an integer as long as its fractional part is exact, leaving nan and inf to printf
+    if (precision <= maxPrecision && std::isfinite(value)) {
+        const uint64_t scale = powersOfTen[precision];
+        const double magnitude = std::fabs(value);
+        const double scaled = magnitude * static_cast<double>(scale);
+        if (scaled < 4503599627370496.0) {
+            // Round half to even, telling exact ties from products which were rounded to one
+            const double integral = std::floor(scaled);
+            const double fraction = scaled - integral;
+            auto rounded = static_cast<uint64_t>(integral);
+            if (fraction > 0.5) {
+                ++rounded;
+            } else if (fraction == 0.5) {
+                const double error = std::fma(magnitude, static_cast<double>(scale), -scaled);
+                if (error > 0 || (error == 0 && rounded % 2 == 1)) {
+                    ++rounded;
+                }
+            }
+
+            if (std::signbit(value)) {
+                buffer.push_back('-');
+            }
+            appendDigits(buffer, rounded / scale);
+            if (precision > 0) {
+                // Pad the decimals with leading zeros
+                buffer.push_back('.');
+                const std::size_t offset = buffer.size();
+                buffer.append(static_cast<std::size_t>(precision), '0');
+                uint64_t decimals = rounded % scale;
+                for (std::size_t i = buffer.size(); i > offset && decimals != 0; decimals /= 10) {
+                    buffer[--i] = static_cast<char>('0' + decimals % 10);
+                }
+            }
+            return;
+        }
+    }
+#endif
+
+    appendFixedFallback(buffer, value, precision);
+}
+
+template <typename T>
+inline void appendValue(std::string& buffer, const T value, const int, IntegerValue) {
+    appendInteger(buffer, value);
+}
+
+template <typename T>
+inline void appendValue(std::string& buffer, const T value, const int precision, FloatingPointValue) {
+    appendFixed(buffer, static_cast<double>(value), precision);
+}
+
+template <typename T>
+inline void appendValue(std::string& buffer, const T& value, const int precision, StreamedValue) {
+    std::stringstream valueStream;
+    valueStream << std::fixed << std::setprecision(precision) << value;
+    buffer.append(valueStream.str());
+}
+
+//! Append a sample rate in (0, 1) with the fewest decimals which read back as the same float, e.g. "0.001"
+inline void appendRate(std::string& buffer, const float rate) {
+    // A call site keeps sampling at the same rate, so the thread remembers the last one it formatted
+    static thread_local float lastRate = -1.f;
+    static thread_local std::string lastText;
+    if (rate == lastRate) {
+        buffer.append(lastText);
+        return;
+    }
+
+    // The rate is scaled to an integer with more and more decimals until it rounds back to the rate
+    constexpr int maxDecimals = 17;
+    uint64_t scale = 1;
+    uint64_t scaled = 0;
+    int decimals = 0;
+    while (decimals < maxDecimals) {
+        ++decimals;
+        scale *= 10;
+        scaled = static_cast<uint64_t>(std::llround(static_cast<double>(rate) * static_cast<double>(scale)));
+        if (static_cast<float>(static_cast<double>(scaled) / static_cast<double>(scale)) == rate) {
+            break;
+        }
+    }
+
+    // Below one, the integral part is zero unless the rate rounded up to it
+    lastText.assign(scaled >= scale ? "1." : "0.");
+    const std::size_t offset = lastText.size();
+    lastText.append(static_cast<std::size_t>(decimals), '0');
+    uint64_t fraction = scaled % scale;
+    for (std::size_t i = lastText.size(); i > offset && fraction != 0; fraction /= 10) {
+        lastText[--i] = static_cast<char>('0' + fraction % 10);
+    }
+    lastRate = rate;
+    buffer.append(lastText);
+}
+
+//! Convert a number to a double, for the values which are not formatted but summarized
+template <typename T>
+inline double toDouble(const T value, IntegerValue) {
+    return static_cast<double>(value);
+}
+
+template <typename T>
+inline double toDouble(const T value, FloatingPointValue) {
+    return static_cast<double>(value);
+}
+
+template <typename T>
+inline double toDouble(const T&, StreamedValue) {
+    return 0;
+}
+
+//! Append a metric value, floating point numbers being written with the given precision
+template <typename T>
+inline void appendValue(std::string& buffer, const T& value, const int precision) {
+    appendValue(buffer, value, precision, ValueCategory<T>());
+}
+
+}  // namespace detail
+}  // namespace Statsd
+
+#endif
@@ -0,0 +1,336 @@
+#ifndef IO_URING_HPP
+#define IO_URING_HPP
+
+// io_uring is a Linux interface, zero-copy sends from registered buffers need the headers of Linux 6.0 or later
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#if defined(IORING_RECVSEND_FIXED_BUF) && defined(IORING_CQE_F_NOTIF)
+#define STATSD_HAS_IO_URING
+#endif
+#endif
+#endif
+
+#ifdef STATSD_HAS_IO_URING
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Statsd {
+namespace detail {
+
+/*!
+ *
+ * io_uring sender
+ *
+ * Sends datagrams through an io_uring, without a syscall per datagram
+ * nor waiting for them to go out. The datagrams are copied into slots
+ * of a buffer registered with the kernel once, which sends them from
+ * there without copying them again (IORING_OP_SEND_ZC). A slot is free
+ * again once the kernel notifies it is done with it.
+ *
+ * The completions are reaped whenever more datagrams are sent, or when
+ * waiting for the ones in flight, and handed to a callback taking the
+ * result of each send: the number of bytes sent or minus the errno.
+ *
+ * Setting the ring up fails where io_uring is not permitted, or is too
+ * old to send from registered buffers, in which case it is unavailable
+ * and the caller sends by itself. It is meant for a single thread.
+ *
+ */
+class IoUringSender final {
+public:
+    //!@name Constructor and destructor, non-copyable
+    //!@{
+
+    //! Constructor, for datagrams of up to slotSize bytes of which up to slots are in flight
+    IoUringSender(const std::size_t slots, const std::size_t slotSize) noexcept;
+
+    //! Destructor, waits for the datagrams in flight
+    ~IoUringSender();
+
+    IoUringSender(const IoUringSender&) = delete;
+    IoUringSender& operator=(const IoUringSender&) = delete;
+
+    //!@}
+
+    //!@name Methods
+    //!@{
+
+    //! Returns true if the ring is set up
+    bool available() const noexcept {
+        return m_ring != -1;
+    }
+
+    //! Submits datagrams, in order, until one does not fit a slot or the ring fails, returns how many were submitted
+    template <typename OnCompletion>
+    std::size_t send(const int socket,
+                     const struct sockaddr* address,
+                     const socklen_t addressLength,
+                     const std::string* datagrams,
+                     const std::size_t count,
+                     OnCompletion&& onCompletion) noexcept;
+
+    //! Waits for every datagram in flight
+    template <typename OnCompletion>
+    void wait(OnCompletion&& onCompletion) noexcept;
+
+    //!@}
+
+private:
+    //! Submits the queued entries, waiting for a completion if asked to, returns false on failure
+    bool enter(const bool waitForOne) noexcept;
+
+    //! Takes back the queued entries the kernel did not consume, freeing their slots, and returns how many
+    unsigned rollBack() noexcept;
+
+    //! Hands the completions over to the callback and frees the slots the kernel is done with
+    template <typename OnCompletion>
+    void reap(OnCompletion& onCompletion) noexcept;
+
+    //! Releases the ring and its mappings
+    void close() noexcept;
+
+    //! The ring file descriptor, -1 when unavailable
+    int m_ring = -1;
+
+    //! The mappings of the rings and of the submission entries
+    void* m_sqRing = MAP_FAILED;
+    std::size_t m_sqRingSize = 0;
+    void* m_cqRing = MAP_FAILED;
+    std::size_t m_cqRingSize = 0;
+    struct io_uring_sqe* m_sqes = static_cast<struct io_uring_sqe*>(MAP_FAILED);
+    std::size_t m_sqesSize = 0;
+
+    //! The fields of the submission ring
+    unsigned* m_sqTail = nullptr;
+    unsigned m_unsubmitted = 0;
+    unsigned m_sqMask = 0;
+    unsigned* m_sqArray = nullptr;
+
+    //! The fields of the completion ring
+    unsigned* m_cqHead = nullptr;
+    unsigned* m_cqTail = nullptr;
+    unsigned m_cqMask = 0;
+    struct io_uring_cqe* m_cqes = nullptr;
+
+    //! The registered buffer, split in slots
+    std::unique_ptr<char[]> m_buffer;
+    std::size_t m_slotSize;
+
+    //! The slots which are not in flight
+    std::vector<uint32_t> m_freeSlots;
+
+    //! The number of slots
+    std::size_t m_slots;
+};
+
+inline IoUringSender::IoUringSender(const std::size_t slots, const std::size_t slotSize) noexcept
+    : m_slotSize(std::max<std::size_t>(slotSize, 1)), m_slots(std::max<std::size_t>(slots, 1)) {
+    struct io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    const int ring = static_cast<int>(syscall(__NR_io_uring_setup, static_cast<unsigned>(m_slots), &params));
+    if (ring < 0) {
+        return;
+    }
+    m_ring = ring;
+
+    // Map the rings, which may share a mapping, and the submission entries
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    const bool singleMapping = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMapping) {
+        m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+    }
+    m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring,
+                    IORING_OFF_SQ_RING);
+    m_cqRing = singleMapping ? m_sqRing
+                             : mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring,
+                                    IORING_OFF_CQ_RING);
+    m_sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    m_sqes = static_cast<struct io_uring_sqe*>(
+        mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_SQES));
+    if (m_sqRing == MAP_FAILED || m_cqRing == MAP_FAILED || m_sqes == MAP_FAILED) {
+        close();
+        return;
+    }
+    char* const sq = static_cast<char*>(m_sqRing);
+    char* const cq = static_cast<char*>(m_cqRing);
+    m_sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    m_sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    m_sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    m_cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    m_cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    m_cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    m_cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    // Zero-copy sends must be supported
+    const std::size_t probeSize = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    std::unique_ptr<char[]> probeBuffer(new char[probeSize]());
+    auto* probe = reinterpret_cast<struct io_uring_probe*>(probeBuffer.get());
+    if (syscall(__NR_io_uring_register, m_ring, IORING_REGISTER_PROBE, probe, 256) < 0 ||
+        probe->last_op < IORING_OP_SEND_ZC || (probe->ops[IORING_OP_SEND_ZC].flags & IO_URING_OP_SUPPORTED) == 0) {
+        close();
+        return;
+    }
+
+    // Register the slots once and for all, which pins their pages
+    m_buffer.reset(new char[m_slots * m_slotSize]);
+    struct iovec buffer;
+    buffer.iov_base = m_buffer.get();
+    buffer.iov_len = m_slots * m_slotSize;
+    if (syscall(__NR_io_uring_register, m_ring, IORING_REGISTER_BUFFERS, &buffer, 1) < 0) {
+        close();
+        return;
+    }
+    for (std::size_t slot = m_slots; slot-- > 0;) {
+        m_freeSlots.push_back(static_cast<uint32_t>(slot));
+    }
+}
+
+inline IoUringSender::~IoUringSender() {
+    wait([](const int) {});
+    close();
+}
+
+inline void IoUringSender::close() noexcept {
+    if (m_sqes != MAP_FAILED) {
+        munmap(m_sqes, m_sqesSize);
+    }
+    if (m_cqRing != MAP_FAILED && m_cqRing != m_sqRing) {
+        munmap(m_cqRing, m_cqRingSize);
+    }
+    if (m_sqRing != MAP_FAILED) {
+        munmap(m_sqRing, m_sqRingSize);
+    }
+    m_sqes = static_cast<struct io_uring_sqe*>(MAP_FAILED);
+    m_sqRing = m_cqRing = MAP_FAILED;
+    if (m_ring != -1) {
+        ::close(m_ring);
+        m_ring = -1;
+    }
+}
+
+template <typename OnCompletion>
+inline std::size_t IoUringSender::send(const int socket,
+                                       const struct sockaddr* address,
+                                       const socklen_t addressLength,
+                                       const std::string* datagrams,
+                                       const std::size_t count,
+                                       OnCompletion&& onCompletion) noexcept {
+    reap(onCompletion);
+
+    std::size_t submitted = 0;
+    unsigned tail = *m_sqTail;
+    while (submitted < count && datagrams[submitted].size() <= m_slotSize) {
+        // Out of slots, submit what is queued and wait for the kernel to be done with one
+        if (m_freeSlots.empty()) {
+            if (!enter(true)) {
+                return submitted - rollBack();
+            }
+            reap(onCompletion);
+            continue;
+        }
+
+        // Copy the datagram into a free slot and describe its send
+        const uint32_t slot = m_freeSlots.back();
+        m_freeSlots.pop_back();
+        const std::string& datagram = datagrams[submitted];
+        char* const data = m_buffer.get() + slot * m_slotSize;
+        std::memcpy(data, datagram.data(), datagram.size());
+
+        const unsigned index = tail & m_sqMask;
+        struct io_uring_sqe* const sqe = &m_sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_SEND_ZC;
+        sqe->fd = socket;
+        sqe->ioprio = IORING_RECVSEND_FIXED_BUF;
+        sqe->buf_index = 0;
+        sqe->addr = reinterpret_cast<uint64_t>(data);
+        sqe->len = static_cast<uint32_t>(datagram.size());
+        sqe->addr2 = reinterpret_cast<uint64_t>(address);
+        sqe->addr_len = static_cast<uint16_t>(addressLength);
+        sqe->user_data = slot;
+        m_sqArray[index] = index;
+        __atomic_store_n(m_sqTail, ++tail, __ATOMIC_RELEASE);
+        ++m_unsubmitted;
+        ++submitted;
+    }
+
+    // Submit without waiting, the completions are reaped next time, and the caller sends what the ring refused
+    if (m_unsubmitted != 0 && !enter(false)) {
+        submitted -= rollBack();
+    }
+    return submitted;
+}
+
+template <typename OnCompletion>
+inline void IoUringSender::wait(OnCompletion&& onCompletion) noexcept {
+    if (!available()) {
+        return;
+    }
+    reap(onCompletion);
+    while (m_freeSlots.size() < m_slots && enter(true)) {
+        reap(onCompletion);
+    }
+}
+
+inline bool IoUringSender::enter(const bool waitForOne) noexcept {
+    const unsigned flags = waitForOne ? IORING_ENTER_GETEVENTS : 0;
+    long ret;
+    do {
+        ret = syscall(__NR_io_uring_enter, m_ring, m_unsubmitted, waitForOne ? 1u : 0u, flags, nullptr, 0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0) {
+        return false;
+    }
+    m_unsubmitted -= std::min(m_unsubmitted, static_cast<unsigned>(ret));
+    return true;
+}
+
+inline unsigned IoUringSender::rollBack() noexcept {
+    // Without a polling thread, the kernel only consumes entries when entering, so the tail is ours to move back
+    const unsigned unsubmitted = m_unsubmitted;
+    unsigned tail = *m_sqTail;
+    for (; m_unsubmitted != 0; --m_unsubmitted) {
+        --tail;
+        m_freeSlots.push_back(static_cast<uint32_t>(m_sqes[tail & m_sqMask].user_data));
+    }
+    __atomic_store_n(m_sqTail, tail, __ATOMIC_RELEASE);
+    return unsubmitted;
+}
+
+template <typename OnCompletion>
+inline void IoUringSender::reap(OnCompletion& onCompletion) noexcept {
+    unsigned head = *m_cqHead;
+    const unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        // A send completes with its result, then with a notification once its slot may be reused
+        const struct io_uring_cqe& cqe = m_cqes[head & m_cqMask];
+        const auto slot = static_cast<uint32_t>(cqe.user_data);
+        if ((cqe.flags & IORING_CQE_F_NOTIF) == 0) {
+            onCompletion(cqe.res);
+        }
+        if ((cqe.flags & IORING_CQE_F_MORE) == 0) {
+            m_freeSlots.push_back(slot);
+        }
+    }
+    __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+}
+
+}  // namespace detail
+}  // namespace Statsd
+
+#endif
+
+#endif
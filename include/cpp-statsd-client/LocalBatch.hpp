@@ -0,0 +1,89 @@
+#ifndef LOCAL_BATCH_HPP
+#define LOCAL_BATCH_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+
+namespace Statsd {
+namespace detail {
+
+/*!
+ *
+ * Local batch
+ *
+ * A batch under construction by a single producer thread, which
+ * appends its messages to it, newline separated, without touching
+ * any state shared with the other producers.
+ *
+ * The batch is shared with the sender it belongs to, which collects
+ * it when the thread leaves it behind. The two take turns through a
+ * flag which only the owning thread sets in the common case, so that
+ * taking it stays in the cache of the owning core.
+ *
+ */
+struct LocalBatch {
+    //! Take the batch, waiting for the other side to be done with it
+    void lock() noexcept {
+        while (busy.exchange(true, std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+    }
+
+    //! Take the batch unless the other side is using it, returns true on success
+    bool tryLock() noexcept {
+        return !busy.exchange(true, std::memory_order_acquire);
+    }
+
+    //! Release the batch
+    void unlock() noexcept {
+        busy.store(false, std::memory_order_release);
+    }
+
+    //! Whether the owning thread or the sender is using the batch
+    std::atomic<bool> busy{false};
+
+    //! The messages, newline separated
+    std::string lines;
+
+    //! The number of messages
+    uint64_t messages = 0;
+};
+
+//! Returns a new identifier for a sender owning local batches, never reused
+inline uint64_t newBatchOwner() noexcept {
+    static std::atomic<uint64_t> next{1};
+    return next.fetch_add(1, std::memory_order_relaxed);
+}
+
+//! Returns the slot of the calling thread for the owner's batch, empty until the owner fills it in
+inline std::shared_ptr<LocalBatch>& threadBatch(const uint64_t owner) noexcept {
+    // A thread keeps the batches of the few senders it last sent through, like the sampling generators
+    struct Slot {
+        uint64_t owner = 0;
+        std::shared_ptr<LocalBatch> batch;
+    };
+    constexpr std::size_t slots = 8;
+    static thread_local Slot cache[slots];
+    static thread_local std::size_t evict = 0;
+
+    for (auto& slot : cache) {
+        if (slot.owner == owner) {
+            return slot.batch;
+        }
+    }
+
+    // An evicted batch is left to its sender, which collects what it holds
+    auto& slot = cache[evict++ % slots];
+    slot.owner = owner;
+    slot.batch.reset();
+    return slot.batch;
+}
+
+}  // namespace detail
+}  // namespace Statsd
+
+#endif
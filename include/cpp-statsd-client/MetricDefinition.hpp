@@ -0,0 +1,274 @@
+#ifndef METRIC_DEFINITION_HPP
+#define METRIC_DEFINITION_HPP
+
+#include <cpp-statsd-client/StringView.hpp>
+#include <cstddef>
+
+#if __cplusplus >= 202002L && defined(__cpp_nontype_template_args) && __cpp_nontype_template_args >= 201911L
+#define STATSD_HAS_STRING_TEMPLATE_ARGS
+#endif
+
+namespace Statsd {
+namespace detail {
+
+// All supported metric types
+constexpr char METRIC_TYPE_COUNT[] = "c";
+constexpr char METRIC_TYPE_GAUGE[] = "g";
+constexpr char METRIC_TYPE_TIMING[] = "ms";
+constexpr char METRIC_TYPE_SET[] = "s";
+
+//! The parts of a metric line around its value: the key and the suffix "|type|#tags"
+struct MetricView {
+    //! The key, without the prefix
+    StringView key;
+
+    //! The type and the tags
+    StringView suffix;
+
+    //! The length of the "|type" part of the suffix, after which the sample rate is inserted
+    std::size_t typeLength;
+};
+
+}  // namespace detail
+
+namespace metric {
+
+/*!
+ *
+ * Metric types
+ *
+ * The types a metric definition takes, see Metric. Any other type
+ * is defined the same way, by the symbol of its lines, and is sent
+ * like those recorded with the custom method. They live in their own
+ * namespace, so as not to clash with the names of the code using the
+ * Statsd one.
+ *
+ */
+struct Count {
+    static constexpr const char* symbol() noexcept {
+        return detail::METRIC_TYPE_COUNT;
+    }
+};
+
+struct Gauge {
+    static constexpr const char* symbol() noexcept {
+        return detail::METRIC_TYPE_GAUGE;
+    }
+};
+
+struct Timing {
+    static constexpr const char* symbol() noexcept {
+        return detail::METRIC_TYPE_TIMING;
+    }
+};
+
+struct Set {
+    static constexpr const char* symbol() noexcept {
+        return detail::METRIC_TYPE_SET;
+    }
+};
+
+}  // namespace metric
+
+namespace detail {
+
+//! Returns the length of a null terminated string
+constexpr std::size_t constLength(const char* string) noexcept {
+    return *string == '\0' ? 0 : 1 + constLength(string + 1);
+}
+
+//! Returns true if the string holds the character
+constexpr bool constContains(const char* string, const char character) noexcept {
+    return *string != '\0' && (*string == character || constContains(string + 1, character));
+}
+
+//! Returns true if the string holds none of the forbidden characters
+constexpr bool constExcludes(const char* string, const char* forbidden) noexcept {
+    return *string == '\0' || (!constContains(forbidden, *string) && constExcludes(string + 1, forbidden));
+}
+
+//! The characters which cannot appear in a key, as they delimit the parts of a line or the lines
+constexpr char k_keyForbidden[] = ":|@\n";
+
+//! The characters which cannot appear in joined tags
+constexpr char k_tagsForbidden[] = "|\n";
+
+//! A null terminated string computed at compile time
+template <std::size_t N>
+struct ConstString {
+    char chars[N + 1];
+};
+
+//! A sequence of indices, to expand the characters of a string
+template <std::size_t... I>
+struct Indices {};
+
+template <std::size_t N, std::size_t... I>
+struct MakeIndices : MakeIndices<N - 1, N - 1, I...> {};
+
+template <std::size_t... I>
+struct MakeIndices<0, I...> {
+    using type = Indices<I...>;
+};
+
+//! Returns the character at an index of "|type|#tags", or of "|type" without tags
+constexpr char suffixAt(const char* type,
+                        const std::size_t typeLength,
+                        const char* tags,
+                        const std::size_t i) noexcept {
+    return i == 0 ? '|'
+                  : i <= typeLength ? type[i - 1]
+                                    : i == typeLength + 1 ? '|' : i == typeLength + 2 ? '#' : tags[i - typeLength - 3];
+}
+
+template <std::size_t... I>
+constexpr ConstString<sizeof...(I)> makeSuffix(const char* type,
+                                               const std::size_t typeLength,
+                                               const char* tags,
+                                               Indices<I...>) noexcept {
+    return {{suffixAt(type, typeLength, tags, I)..., '\0'}};
+}
+
+/*!
+ *
+ * Metric layout
+ *
+ * The parts of the lines of a metric definition, validated and laid
+ * out at compile time: the key and the suffix "|type|#tags". Only the
+ * prefix of the client, which is configured at runtime, and the value
+ * are left to write when recording.
+ *
+ */
+template <typename Definition>
+struct MetricLayout {
+    static_assert(constExcludes(Definition::key(), k_keyForbidden),
+                  "A metric key cannot contain ':', '|', '@' or a newline");
+    static_assert(constExcludes(Definition::tags(), k_tagsForbidden), "Metric tags cannot contain '|' or a newline");
+
+    //! The lengths of the parts
+    static constexpr std::size_t keyLength = constLength(Definition::key());
+    static constexpr std::size_t typeLength = 1 + constLength(Definition::type::symbol());
+    static constexpr std::size_t tagsLength = constLength(Definition::tags());
+    static constexpr std::size_t suffixLength = typeLength + (tagsLength == 0 ? 0 : 2 + tagsLength);
+
+    //! The suffix
+    static constexpr ConstString<suffixLength> suffix =
+        makeSuffix(Definition::type::symbol(), typeLength - 1, Definition::tags(),
+                   typename MakeIndices<suffixLength>::type());
+
+    //! Returns a view of the parts
+    static constexpr MetricView view() noexcept {
+        return {StringView(Definition::key(), keyLength), StringView(suffix.chars, suffixLength), typeLength};
+    }
+};
+
+template <typename Definition>
+constexpr ConstString<MetricLayout<Definition>::suffixLength> MetricLayout<Definition>::suffix;
+
+}  // namespace detail
+
+#ifdef STATSD_HAS_STRING_TEMPLATE_ARGS
+
+/*!
+ *
+ * Fixed string
+ *
+ * A string literal passed as a template argument, e.g. to Metric.
+ *
+ */
+template <std::size_t N>
+struct FixedString {
+    //! Constructor, from a string literal
+    constexpr FixedString(const char (&string)[N]) noexcept {
+        for (std::size_t i = 0; i < N; ++i) {
+            chars[i] = string[i];
+        }
+    }
+
+    //! The characters, null terminated
+    char chars[N]{};
+};
+
+/*!
+ *
+ * Static tags
+ *
+ * The tags of a metric definition, e.g. Tags<"shard:1", "db:main">,
+ * joined with commas at compile time.
+ *
+ */
+template <FixedString... Tag>
+struct Tags {
+    static_assert((detail::constExcludes(Tag.chars, ",") && ...), "A tag cannot contain ','");
+
+    //! Returns the tags, comma separated
+    static constexpr const char* joined() noexcept {
+        return k_joined.chars;
+    }
+
+private:
+    //! The size of the joined tags, each null terminator making room for a comma or the final one
+    static constexpr std::size_t k_size = (std::size_t{1} + ... + sizeof(Tag.chars)) - (sizeof...(Tag) == 0 ? 0 : 1);
+
+    static constexpr detail::ConstString<k_size - 1> k_joined = [] {
+        detail::ConstString<k_size - 1> joined{};
+        const char* tags[] = {Tag.chars..., nullptr};
+        std::size_t length = 0;
+        for (const char** tag = tags; *tag != nullptr; ++tag) {
+            if (length != 0) {
+                joined.chars[length++] = ',';
+            }
+            for (const char* c = *tag; *c != '\0'; ++c) {
+                joined.chars[length++] = *c;
+            }
+        }
+        return joined;
+    }();
+};
+
+/*!
+ *
+ * Metric definition
+ *
+ * A metric whose key, type and tags are known at compile time, e.g.
+ * Metric<"db.query", metric::Timing, Tags<"shard:1">>, recorded with the
+ * record method of the client. The key and the tags are validated by
+ * the compiler, which also lays out the line around the value.
+ *
+ * Before C++20, the same definition is spelled with STATSD_METRIC.
+ *
+ */
+template <FixedString Key, typename Type, typename StaticTags = Tags<>>
+struct Metric {
+    //! The type of the metric
+    using type = Type;
+
+    //! Returns the key
+    static constexpr const char* key() noexcept {
+        return Key.chars;
+    }
+
+    //! Returns the tags, comma separated
+    static constexpr const char* tags() noexcept {
+        return StaticTags::joined();
+    }
+};
+
+#endif
+
+}  // namespace Statsd
+
+//! Define a metric whose key, type and tags, comma separated, are known at compile time, see Statsd::Metric
+//! e.g. STATSD_METRIC(DbQuery, "db.query", Statsd::metric::Timing, "shard:1");
+#define STATSD_METRIC(Name, Key, Type, JoinedTags)      \
+    struct Name {                                      \
+        using type = Type;                             \
+        static constexpr const char* key() noexcept {  \
+            return Key;                                \
+        }                                              \
+        static constexpr const char* tags() noexcept { \
+            return JoinedTags;                         \
+        }                                              \
+    }
+
+#endif
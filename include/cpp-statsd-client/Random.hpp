@@ -0,0 +1,111 @@
+#ifndef RANDOM_HPP
+#define RANDOM_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace Statsd {
+namespace detail {
+
+/*!
+ *
+ * Sampling random numbers
+ *
+ * Each thread draws from its own xoshiro256** generator, whose
+ * 32 bytes of state stay in the cache of the core running it, so
+ * that sampling takes neither a lock nor a shared cache line.
+ *
+ * A generator is seeded by splitmix64 from the seed of the client
+ * and the index of the thread, which keeps the draws of a given
+ * thread reproducible after seeding the client. The draws are
+ * compared to an integer threshold derived from the frequency.
+ *
+ */
+
+//! Advance a splitmix64 state and return its next output
+inline uint64_t splitmix64(uint64_t& state) noexcept {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+//! The xoshiro256** generator
+class Xoshiro256 {
+public:
+    //! Seed the state through splitmix64, which never leaves it all zeros
+    void seed(uint64_t seed) noexcept {
+        for (auto& word : m_state) {
+            word = splitmix64(seed);
+        }
+    }
+
+    //! Return the next 64 random bits
+    uint64_t next() noexcept {
+        const uint64_t result = rotate(m_state[1] * 5, 7) * 9;
+        const uint64_t shifted = m_state[1] << 17;
+        m_state[2] ^= m_state[0];
+        m_state[3] ^= m_state[1];
+        m_state[1] ^= m_state[2];
+        m_state[0] ^= m_state[3];
+        m_state[2] ^= shifted;
+        m_state[3] = rotate(m_state[3], 45);
+        return result;
+    }
+
+private:
+    static uint64_t rotate(const uint64_t value, const int bits) noexcept {
+        return (value << bits) | (value >> (64 - bits));
+    }
+
+    //! The state
+    uint64_t m_state[4] = {};
+};
+
+//! Returns the index of the calling thread, threads being numbered from 0 in the order they first ask
+inline std::size_t threadIndex() noexcept {
+    static std::atomic<std::size_t> next{0};
+    static thread_local const std::size_t index = next.fetch_add(1, std::memory_order_relaxed);
+    return index;
+}
+
+//! Returns a new identifier for a sequence of draws, every seeding of a client starting a new one
+inline uint64_t newRandomStream() noexcept {
+    static std::atomic<uint64_t> next{1};
+    return next.fetch_add(1, std::memory_order_relaxed);
+}
+
+//! Returns the generator of the calling thread for the stream, seeding it on first use in the thread
+inline Xoshiro256& threadGenerator(const uint64_t stream, const uint64_t seed) noexcept {
+    // A thread keeps the generators of the few clients it last sampled for
+    struct Slot {
+        uint64_t stream = 0;
+        Xoshiro256 generator;
+    };
+    constexpr std::size_t slots = 4;
+    static thread_local Slot cache[slots];
+    static thread_local std::size_t evict = 0;
+
+    for (auto& slot : cache) {
+        if (slot.stream == stream) {
+            return slot.generator;
+        }
+    }
+
+    auto& slot = cache[evict++ % slots];
+    slot.stream = stream;
+    slot.generator.seed(seed + 0x9e3779b97f4a7c15ull * static_cast<uint64_t>(threadIndex()));
+    return slot.generator;
+}
+
+//! Returns true if a draw falls under the frequency, which must be in [0, 1)
+inline bool sampled(Xoshiro256& generator, const float frequency) noexcept {
+    const auto threshold = static_cast<uint64_t>(static_cast<double>(frequency) * 18446744073709551616.0);
+    return generator.next() < threshold;
+}
+
+}  // namespace detail
+}  // namespace Statsd
+
+#endif
@@ -0,0 +1,169 @@
+#ifndef RCU_POINTER_HPP
+#define RCU_POINTER_HPP
+
+#include <cpp-statsd-client/Random.hpp>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace Statsd {
+namespace detail {
+
+/*!
+ *
+ * RCU pointer
+ *
+ * An owning pointer which readers follow without locking while a
+ * writer replaces the object, in the spirit of read-copy-update: the
+ * writer builds the new object off to the side, publishes it, then
+ * waits for the readers which may still hold the old one before
+ * handing it back.
+ *
+ * Readers pin the object for as long as a Reader lives, by counting
+ * themselves in one of two generations of counters, the one of the
+ * current epoch. Publishing flips the epoch, so that new readers count
+ * themselves in the other generation, and the writer only waits for
+ * the previous one to drain. A reader which saw the epoch flip before
+ * it was counted backs off and tries again. The counters are striped
+ * by thread index like the stats, so that readers on different cores
+ * do not bounce one cache line.
+ *
+ * Writers are serialized by a mutex, which readers never take.
+ *
+ */
+template <typename T>
+class RcuPointer final {
+public:
+    //! Pins the published object while it lives
+    class Reader final {
+    public:
+        //! Constructor, pins the object published by the pointer
+        explicit Reader(const RcuPointer& pointer) noexcept;
+
+        //! Destructor, unpins the object
+        ~Reader();
+
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+        //! Returns the pinned object
+        const T& operator*() const noexcept {
+            return *m_object;
+        }
+        const T* operator->() const noexcept {
+            return m_object;
+        }
+
+    private:
+        //! The counter the reader counted itself in
+        std::atomic<uint64_t>* m_counter;
+
+        //! The pinned object
+        const T* m_object;
+    };
+
+    //!@name Constructor and destructor, non-copyable
+    //!@{
+
+    //! Constructor, publishes the object
+    explicit RcuPointer(std::unique_ptr<T> object) noexcept : m_object(object.release()) {}
+
+    //! Destructor, destroys the object, which no reader may hold anymore
+    ~RcuPointer() {
+        delete m_object.load(std::memory_order_acquire);
+    }
+
+    RcuPointer(const RcuPointer&) = delete;
+    RcuPointer& operator=(const RcuPointer&) = delete;
+
+    //!@}
+
+    //!@name Methods
+    //!@{
+
+    //! Publishes a new object, then returns the previous one once no reader holds it anymore
+    std::unique_ptr<T> exchange(std::unique_ptr<T> object) noexcept;
+
+    //! Returns the published object, which only the writers may use unpinned
+    T* get() const noexcept {
+        return m_object.load(std::memory_order_acquire);
+    }
+
+    //!@}
+
+private:
+    //! The number of stripes of a generation of counters
+    static constexpr std::size_t k_stripes{16};
+
+    //! A counter of readers, padded to the assumed size of a cache line
+    struct Stripe {
+        std::atomic<uint64_t> readers{0};
+        char padding[64 - sizeof(std::atomic<uint64_t>)];
+    };
+
+    //! Returns the number of readers counted in the generation
+    uint64_t readers(const uint64_t generation) const noexcept;
+
+    //! The published object
+    std::atomic<T*> m_object;
+
+    //! The epoch, whose parity is the generation new readers count themselves in
+    std::atomic<uint64_t> m_epoch{0};
+
+    //! The two generations of counters of readers
+    mutable Stripe m_stripes[2][k_stripes];
+
+    //! The mutex serializing the writers
+    std::mutex m_writerMutex;
+};
+
+template <typename T>
+inline RcuPointer<T>::Reader::Reader(const RcuPointer& pointer) noexcept {
+    // Sequentially consistent throughout: the writer must either see the reader counted or the reader see the flip
+    const std::size_t stripe = threadIndex() % k_stripes;
+    for (;;) {
+        const uint64_t epoch = pointer.m_epoch.load();
+        m_counter = &pointer.m_stripes[epoch & 1][stripe].readers;
+        m_counter->fetch_add(1);
+        if (pointer.m_epoch.load() == epoch) {
+            break;
+        }
+        m_counter->fetch_sub(1, std::memory_order_release);
+    }
+    m_object = pointer.m_object.load();
+}
+
+template <typename T>
+inline RcuPointer<T>::Reader::~Reader() {
+    m_counter->fetch_sub(1, std::memory_order_release);
+}
+
+template <typename T>
+inline std::unique_ptr<T> RcuPointer<T>::exchange(std::unique_ptr<T> object) noexcept {
+    std::lock_guard<std::mutex> lock(m_writerMutex);
+    std::unique_ptr<T> previous(m_object.exchange(object.release()));
+
+    // Readers counted from now on may only see the new object, wait for those which may have seen the previous one
+    const uint64_t generation = m_epoch.fetch_add(1) & 1;
+    while (readers(generation) != 0) {
+        std::this_thread::yield();
+    }
+    return previous;
+}
+
+template <typename T>
+inline uint64_t RcuPointer<T>::readers(const uint64_t generation) const noexcept {
+    uint64_t sum = 0;
+    for (const auto& stripe : m_stripes[generation]) {
+        sum += stripe.readers.load(std::memory_order_acquire);
+    }
+    return sum;
+}
+
+}  // namespace detail
+}  // namespace Statsd
+
+#endif
@@ -0,0 +1,215 @@
+#ifndef RING_BUFFER_HPP
+#define RING_BUFFER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+
+namespace Statsd {
+
+/*!
+ *
+ * Ring buffer
+ *
+ * A bounded, lock-free, multi-producer single-consumer ring of
+ * variable length byte records.
+ *
+ * The storage is split in cells of fixed size and every record
+ * starts on a cell boundary. Producers reserve the cells of a
+ * record with a single compare-and-swap on the head, copy their
+ * bytes in, and commit the record by publishing its length in
+ * the header slot of its first cell. The consumer reads committed
+ * records in reservation order and releases their cells by moving
+ * the tail forward. A record which would straddle the end of the
+ * storage is preceded by a padding record so that its bytes are
+ * always contiguous.
+ *
+ * Producers never wait on each other beyond the reservation: a
+ * slow producer only delays the consumer, which stops at the first
+ * record that is reserved but not committed yet.
+ *
+ */
+class RingBuffer final {
+public:
+    //! A reserved record, to be filled then committed
+    struct Reservation {
+        //! Where to write the record, nullptr if the reservation failed
+        char* data;
+
+        //! The size of the record
+        std::size_t size;
+
+        //! The first cell of the record
+        uint64_t cell;
+    };
+
+    //!@name Constructor, non-copyable
+    //!@{
+
+    //! Constructor, the capacity in bytes is rounded up to a power of two
+    explicit RingBuffer(const std::size_t capacity) noexcept;
+
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer& operator=(const RingBuffer&) = delete;
+
+    //!@}
+
+    //!@name Methods
+    //!@{
+
+    //! Reserve room for a record of the given size, the data is nullptr when the ring is full
+    Reservation reserve(const std::size_t size) noexcept;
+
+    //! Make a reserved record visible to the consumer
+    void commit(const Reservation& reservation) noexcept;
+
+    //! Copy a record in, returns false when the ring is full
+    bool push(const char* data, const std::size_t size) noexcept;
+
+    //! Hand the committed records over to the consumer in order, up to a maximum, returns the number consumed
+    template <typename Consumer>
+    std::size_t consume(Consumer&& consumer,
+                        const std::size_t maxRecords = std::numeric_limits<std::size_t>::max()) noexcept;
+
+    //! Returns the number of bytes currently reserved
+    std::size_t size() const noexcept;
+
+    //! Returns the capacity in bytes
+    std::size_t capacity() const noexcept;
+
+    //!@}
+
+private:
+    //! The granularity of the storage, which bounds the space wasted per record
+    static constexpr std::size_t k_cellSize{16};
+
+    //! The header of a padding record, which extends to the end of the storage
+    static constexpr uint32_t k_padding{UINT32_MAX};
+
+    //! The assumed size of a cache line
+    static constexpr std::size_t k_cacheLine{64};
+
+    //! Returns the number of cells needed by a record of the given size
+    static uint64_t cellsFor(const std::size_t size) noexcept;
+
+    //! The number of cells, a power of two
+    uint64_t m_cells;
+
+    //! The records
+    std::unique_ptr<char[]> m_data;
+
+    //! The header of each cell: 0 when nothing is committed there, the record size + 1 otherwise
+    std::unique_ptr<std::atomic<uint32_t>[]> m_headers;
+
+    //! The next cell to reserve, written by the producers
+    char m_headPadding[k_cacheLine];
+    std::atomic<uint64_t> m_head{0};
+
+    //! The next cell to consume, written by the consumer
+    char m_tailPadding[k_cacheLine - sizeof(std::atomic<uint64_t>)];
+    std::atomic<uint64_t> m_tail{0};
+    char m_endPadding[k_cacheLine - sizeof(std::atomic<uint64_t>)];
+};
+
+inline RingBuffer::RingBuffer(const std::size_t capacity) noexcept : m_cells(1) {
+    while (m_cells * k_cellSize < capacity) {
+        m_cells <<= 1;
+    }
+    m_data.reset(new char[m_cells * k_cellSize]);
+    m_headers.reset(new std::atomic<uint32_t>[m_cells]);
+    for (uint64_t i = 0; i < m_cells; ++i) {
+        m_headers[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+inline uint64_t RingBuffer::cellsFor(const std::size_t size) noexcept {
+    return size == 0 ? 1 : (size + k_cellSize - 1) / k_cellSize;
+}
+
+inline RingBuffer::Reservation RingBuffer::reserve(const std::size_t size) noexcept {
+    const uint64_t cells = cellsFor(size);
+    // The header holds the size + 1, which must stay short of the padding header
+    if (cells > m_cells || size >= k_padding - 1) {
+        return Reservation{nullptr, size, 0};
+    }
+
+    uint64_t head = m_head.load(std::memory_order_relaxed);
+    while (true) {
+        // Pad up to the end of the storage when the record would wrap around
+        const uint64_t offset = head & (m_cells - 1);
+        const uint64_t padding = offset + cells > m_cells ? m_cells - offset : 0;
+
+        // The acquire pairs with the consumer releasing cells, after which they can be overwritten
+        const uint64_t tail = m_tail.load(std::memory_order_acquire);
+        if (head + padding + cells - tail > m_cells) {
+            return Reservation{nullptr, size, 0};
+        }
+
+        if (m_head.compare_exchange_weak(head, head + padding + cells, std::memory_order_relaxed)) {
+            if (padding != 0) {
+                m_headers[offset].store(k_padding, std::memory_order_release);
+            }
+            const uint64_t cell = (head + padding) & (m_cells - 1);
+            return Reservation{m_data.get() + cell * k_cellSize, size, cell};
+        }
+    }
+}
+
+inline void RingBuffer::commit(const Reservation& reservation) noexcept {
+    m_headers[reservation.cell].store(static_cast<uint32_t>(reservation.size + 1), std::memory_order_release);
+}
+
+inline bool RingBuffer::push(const char* data, const std::size_t size) noexcept {
+    const auto reservation = reserve(size);
+    if (reservation.data == nullptr) {
+        return false;
+    }
+    std::memcpy(reservation.data, data, size);
+    commit(reservation);
+    return true;
+}
+
+template <typename Consumer>
+inline std::size_t RingBuffer::consume(Consumer&& consumer, const std::size_t maxRecords) noexcept {
+    std::size_t consumed = 0;
+    uint64_t tail = m_tail.load(std::memory_order_relaxed);
+    const uint64_t head = m_head.load(std::memory_order_acquire);
+    while (tail != head && consumed < maxRecords) {
+        // Stop at the first record which is not committed yet
+        const uint64_t offset = tail & (m_cells - 1);
+        const uint32_t header = m_headers[offset].load(std::memory_order_acquire);
+        if (header == 0) {
+            break;
+        }
+
+        if (header == k_padding) {
+            tail += m_cells - offset;
+        } else {
+            const std::size_t size = header - 1;
+            consumer(m_data.get() + offset * k_cellSize, size);
+            tail += cellsFor(size);
+            ++consumed;
+        }
+
+        // Release the cells to the producers
+        m_headers[offset].store(0, std::memory_order_relaxed);
+        m_tail.store(tail, std::memory_order_release);
+    }
+    return consumed;
+}
+
+inline std::size_t RingBuffer::size() const noexcept {
+    const uint64_t tail = m_tail.load(std::memory_order_relaxed);
+    const uint64_t head = m_head.load(std::memory_order_relaxed);
+    return head > tail ? static_cast<std::size_t>((head - tail) * k_cellSize) : 0;
+}
+
+inline std::size_t RingBuffer::capacity() const noexcept {
+    return static_cast<std::size_t>(m_cells * k_cellSize);
+}
+
+}  // namespace Statsd
+
+#endif
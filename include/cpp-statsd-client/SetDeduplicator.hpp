@@ -0,0 +1,305 @@
+#ifndef SET_DEDUPLICATOR_HPP
+#define SET_DEDUPLICATOR_HPP
+
+#include <cpp-statsd-client/Formatter.hpp>
+#include <cpp-statsd-client/Random.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace Statsd {
+
+/*!
+ *
+ * Set options
+ *
+ * How the members of sets are deduplicated when the client keeps them.
+ *
+ */
+struct SetOptions {
+    //! The number of distinct members kept exactly per set, beyond which the set is estimated
+    std::size_t exactThreshold = 1000;
+
+    //! The precision of the estimates, which use 2^precision bytes per set, in [4, 16]
+    int precision = 12;
+};
+
+/*!
+ *
+ * HyperLogLog
+ *
+ * Estimates the number of distinct values added to it with a
+ * standard error of 1.04 / sqrt(2^precision), in 2^precision
+ * one-byte registers.
+ *
+ */
+class HyperLogLog {
+public:
+    //! Constructor
+    explicit HyperLogLog(const int precision) noexcept;
+
+    //!@name Methods
+    //!@{
+
+    //! Adds a hashed value
+    void add(const uint64_t hash) noexcept;
+
+    //! Adds the values of another estimate of the same precision, as if they had been added to this one
+    void merge(const HyperLogLog& other) noexcept;
+
+    //! Returns the estimated number of distinct values
+    double estimate() const noexcept;
+
+    //! Returns a well mixed hash of the characters
+    static uint64_t hash(const std::string& value) noexcept;
+
+    //!@}
+
+private:
+    //! The number of bits of a hash selecting a register
+    int m_precision;
+
+    //! The largest rank of the hashes falling in each register
+    std::vector<uint8_t> m_registers;
+};
+
+/*!
+ *
+ * Set deduplicator
+ *
+ * Keeps the members of each set so that each distinct member is
+ * emitted at most once per flush. A set holds its members exactly up
+ * to a threshold, then switches to a HyperLogLog for the rest of the
+ * interval and is emitted as a gauge of its estimated cardinality,
+ * "prefix.key.cardinality:estimate|g|#tags", which bounds the memory.
+ *
+ * Like in the aggregator, a set is identified by its serialized line
+ * without the value, i.e. "prefix.key|s|#tags", and the table is split
+ * into stripes picked by the thread index, each with its own lock. The
+ * stripes are merged at the flush: the exact members are joined, and
+ * the estimates take the largest of their registers, a set which joins
+ * more members than the threshold being estimated from then on.
+ *
+ */
+class SetDeduplicator final {
+public:
+    //! Constructor
+    explicit SetDeduplicator(const SetOptions& options) noexcept;
+
+    //!@name Methods
+    //!@{
+
+    //! Adds a formatted member to the set identified by the serialized metric
+    void add(const std::string& metric,
+             const std::size_t nameLength,
+             const std::size_t typeLength,
+             const std::string& member) noexcept;
+
+    //! Hands the lines of every set to the sink and resets the table
+    template <typename Sink>
+    void flush(Sink&& sink) noexcept;
+
+    //!@}
+
+private:
+    //! A deduplicated set
+    struct Entry {
+        //! The length of the "prefix.key" part of the serialized metric
+        std::size_t nameLength;
+
+        //! The offset of the "|#tags" part of the serialized metric
+        std::size_t tagsOffset;
+
+        //! The distinct members, until there are too many of them
+        std::unordered_set<std::string> members;
+
+        //! The estimate of the distinct members, once there are too many of them
+        std::unique_ptr<HyperLogLog> estimate;
+    };
+
+    //! The deduplicated sets, keyed by serialized metric
+    using Table = std::unordered_map<std::string, Entry>;
+
+    //! The number of stripes
+    static constexpr std::size_t k_stripes{16};
+
+    //! A stripe of the table, padded so that the locks of neighbouring stripes do not share a cache line
+    struct Stripe {
+        //! The deduplicated sets of the stripe
+        Table entries;
+
+        //! The mutex guarding them
+        std::mutex mutex;
+
+        char padding[64];
+    };
+
+    //! Move the members of a set to an estimate once there are more of them than the threshold
+    void estimateIfLarge(Entry& entry) const noexcept;
+
+    //! Merge the members of a set kept by another stripe into the set
+    void merge(Entry& kept, Entry& entry) const noexcept;
+
+    //! The options
+    SetOptions m_options;
+
+    //! The stripes
+    Stripe m_stripes[k_stripes];
+};
+
+inline HyperLogLog::HyperLogLog(const int precision) noexcept
+    : m_precision(std::max(4, std::min(precision, 16))), m_registers(std::size_t{1} << m_precision, 0) {}
+
+inline void HyperLogLog::add(const uint64_t hash) noexcept {
+    // The first bits select the register, the rank is the position of the first set bit among the others
+    const auto index = static_cast<std::size_t>(hash >> (64 - m_precision));
+    const uint64_t rest = hash << m_precision;
+    uint8_t rank = 1;
+    for (uint64_t bit = uint64_t{1} << 63; (rest & bit) == 0 && rank <= 64 - m_precision; bit >>= 1) {
+        ++rank;
+    }
+    m_registers[index] = std::max(m_registers[index], rank);
+}
+
+inline void HyperLogLog::merge(const HyperLogLog& other) noexcept {
+    for (std::size_t i = 0; i < m_registers.size() && i < other.m_registers.size(); ++i) {
+        m_registers[i] = std::max(m_registers[i], other.m_registers[i]);
+    }
+}
+
+inline double HyperLogLog::estimate() const noexcept {
+    const auto registers = static_cast<double>(m_registers.size());
+    double sum = 0;
+    std::size_t zeros = 0;
+    for (const uint8_t rank : m_registers) {
+        sum += std::ldexp(1., -rank);
+        zeros += rank == 0 ? 1 : 0;
+    }
+    const double alpha = 0.7213 / (1 + 1.079 / registers);
+    const double estimate = alpha * registers * registers / sum;
+
+    // Small cardinalities are better estimated by counting the empty registers
+    if (estimate <= 2.5 * registers && zeros != 0) {
+        return registers * std::log(registers / static_cast<double>(zeros));
+    }
+    return estimate;
+}
+
+inline uint64_t HyperLogLog::hash(const std::string& value) noexcept {
+    // FNV-1a over the characters, then mixed so that every bit depends on all of them
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (const char c : value) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001b3ull;
+    }
+    return detail::splitmix64(hash);
+}
+
+inline SetDeduplicator::SetDeduplicator(const SetOptions& options) noexcept : m_options(options) {}
+
+inline void SetDeduplicator::add(const std::string& metric,
+                                 const std::size_t nameLength,
+                                 const std::size_t typeLength,
+                                 const std::string& member) noexcept {
+    auto& stripe = m_stripes[detail::threadIndex() % k_stripes];
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    auto it = stripe.entries.find(metric);
+    if (it == stripe.entries.end()) {
+        it = stripe.entries.emplace(metric, Entry{nameLength, nameLength + typeLength, {}, nullptr}).first;
+    }
+    auto& entry = it->second;
+
+    if (entry.estimate) {
+        entry.estimate->add(HyperLogLog::hash(member));
+        return;
+    }
+    entry.members.insert(member);
+    estimateIfLarge(entry);
+}
+
+inline void SetDeduplicator::estimateIfLarge(Entry& entry) const noexcept {
+    if (entry.members.size() <= m_options.exactThreshold) {
+        return;
+    }
+    entry.estimate.reset(new HyperLogLog(m_options.precision));
+    for (const auto& kept : entry.members) {
+        entry.estimate->add(HyperLogLog::hash(kept));
+    }
+    std::unordered_set<std::string>().swap(entry.members);
+}
+
+inline void SetDeduplicator::merge(Entry& kept, Entry& entry) const noexcept {
+    // An estimate takes the registers of the other estimate, or the hashes of its members
+    if (kept.estimate || entry.estimate) {
+        if (!kept.estimate) {
+            kept.estimate.swap(entry.estimate);
+            kept.members.swap(entry.members);
+        }
+        if (entry.estimate) {
+            kept.estimate->merge(*entry.estimate);
+        }
+        for (const auto& member : entry.members) {
+            kept.estimate->add(HyperLogLog::hash(member));
+        }
+        return;
+    }
+    kept.members.insert(entry.members.begin(), entry.members.end());
+    estimateIfLarge(kept);
+}
+
+template <typename Sink>
+inline void SetDeduplicator::flush(Sink&& sink) noexcept {
+    // Swap the stripes out one at a time so that producers are only blocked for the swap, then merge them
+    Table staged;
+    for (auto& stripe : m_stripes) {
+        Table entries;
+        std::unique_lock<std::mutex> lock(stripe.mutex);
+        stripe.entries.swap(entries);
+        lock.unlock();
+
+        if (staged.empty()) {
+            staged.swap(entries);
+            continue;
+        }
+        for (auto& entry : entries) {
+            auto it = staged.find(entry.first);
+            if (it == staged.end()) {
+                staged.emplace(entry.first, std::move(entry.second));
+            } else {
+                merge(it->second, entry.second);
+            }
+        }
+    }
+
+    // Emit "prefix.key:member|s|#tags" per member, or "prefix.key.cardinality:estimate|g|#tags"
+    std::string line;
+    for (const auto& staging : staged) {
+        const auto& metric = staging.first;
+        const auto& entry = staging.second;
+        if (entry.estimate) {
+            line.assign(metric, 0, entry.nameLength);
+            line.append(".cardinality:");
+            detail::appendInteger(line, static_cast<uint64_t>(std::llround(entry.estimate->estimate())));
+            line.append("|g");
+            line.append(metric, entry.tagsOffset, std::string::npos);
+            sink(line);
+            continue;
+        }
+        for (const auto& member : entry.members) {
+            line.assign(metric, 0, entry.nameLength);
+            line.push_back(':');
+            line.append(member);
+            line.append(metric, entry.nameLength, std::string::npos);
+            sink(line);
+        }
+    }
+}
+
+}  // namespace Statsd
+
+#endif
@@ -0,0 +1,367 @@
+#ifndef SKETCH_HPP
+#define SKETCH_HPP
+
+#include <cpp-statsd-client/Formatter.hpp>
+#include <cpp-statsd-client/Random.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Statsd {
+
+/*!
+ *
+ * Sketch options
+ *
+ * How timings are summarized when the client keeps them in sketches.
+ *
+ */
+struct SketchOptions {
+    //! The relative error of the percentiles, e.g. 0.01 for values within 1% of the exact ones
+    double relativeAccuracy = 0.01;
+
+    //! The maximum number of bins of a sketch, beyond which the lowest bins are merged
+    std::size_t maxBins = 2048;
+
+    //! The percentiles emitted for every timing, in [0, 100]
+    std::vector<double> percentiles{50, 90, 99};
+};
+
+/*!
+ *
+ * Latency sketch
+ *
+ * A DDSketch: values are counted in bins whose bounds grow
+ * geometrically, so that any percentile is estimated within the
+ * relative accuracy. The bins are contiguous and their number is
+ * bounded, the lowest ones being merged when the range of values
+ * grows beyond it, which keeps the tail percentiles accurate.
+ * Sketches with the same accuracy can be merged.
+ *
+ * Values too small to be binned, including zero and negative ones,
+ * are counted apart as zeros. The maximum is kept exactly.
+ *
+ */
+class LatencySketch {
+public:
+    //! Constructor
+    LatencySketch(const double relativeAccuracy, const std::size_t maxBins) noexcept;
+
+    //!@name Methods
+    //!@{
+
+    //! Adds a value
+    void add(const double value) noexcept;
+
+    //! Adds the values of another sketch with the same accuracy
+    void merge(const LatencySketch& other) noexcept;
+
+    //! Returns the estimated value at a quantile in [0, 1]
+    double quantile(const double quantile) const noexcept;
+
+    //! Returns the number of values
+    uint64_t count() const noexcept {
+        return m_count;
+    }
+
+    //! Returns the largest value
+    double max() const noexcept {
+        return m_max;
+    }
+
+    //!@}
+
+private:
+    //! Adds a number of values to the bin of an index
+    void add(const int index, const uint64_t count) noexcept;
+
+    //! The growth factor of the bins
+    double m_gamma;
+
+    //! The logarithm of the growth factor
+    double m_logGamma;
+
+    //! The smallest value which is binned
+    double m_minValue;
+
+    //! The maximum number of bins
+    std::size_t m_maxBins;
+
+    //! The counts of the bins, from the one of index m_offset on
+    std::vector<uint64_t> m_bins;
+
+    //! The index of the first bin
+    int m_offset;
+
+    //! The number of values too small to be binned
+    uint64_t m_zeros;
+
+    //! The number of values
+    uint64_t m_count;
+
+    //! The largest value
+    double m_max;
+};
+
+/*!
+ *
+ * Timing sketches
+ *
+ * Keeps a latency sketch per timing so that each distinct timing is
+ * emitted as a few percentiles, its maximum and its count once per
+ * flush, rather than as every value.
+ *
+ * Like in the aggregator, a timing is identified by its serialized line
+ * without the value, i.e. "prefix.key|ms|#tags". The lengths of the
+ * "prefix.key" and "|ms" parts are kept alongside to build the lines
+ * "prefix.key.p99:value|g|#tags".
+ *
+ * The table is split into stripes picked by the thread index, each with
+ * its own lock, so that threads timing at once seldom wait on each
+ * other. The sketches of a timing in several stripes, which all have
+ * the same accuracy, are merged at the flush by adding up their bins.
+ *
+ */
+class TimingSketches final {
+public:
+    //! Constructor
+    explicit TimingSketches(const SketchOptions& options) noexcept;
+
+    //!@name Methods
+    //!@{
+
+    //! Adds a value to the sketch of the timing identified by the serialized metric
+    void add(const std::string& metric,
+             const std::size_t nameLength,
+             const std::size_t typeLength,
+             const double value) noexcept;
+
+    //! Hands the lines of every sketch to the sink and resets the table
+    template <typename Sink>
+    void flush(Sink&& sink, const int precision) noexcept;
+
+    //!@}
+
+private:
+    //! A sketched timing
+    struct Entry {
+        //! The length of the "prefix.key" part of the serialized metric
+        std::size_t nameLength;
+
+        //! The offset of the "|#tags" part of the serialized metric
+        std::size_t tagsOffset;
+
+        //! The sketch of the values
+        LatencySketch sketch;
+    };
+
+    //! The options
+    SketchOptions m_options;
+
+    //! The names of the percentiles, e.g. "p99" or "p99.9"
+    std::vector<std::string> m_names;
+
+    //! The sketched timings, keyed by serialized metric
+    using Table = std::unordered_map<std::string, Entry>;
+
+    //! The number of stripes
+    static constexpr std::size_t k_stripes{16};
+
+    //! A stripe of the table, padded so that the locks of neighbouring stripes do not share a cache line
+    struct Stripe {
+        //! The sketched timings of the stripe
+        Table entries;
+
+        //! The mutex guarding them
+        std::mutex mutex;
+
+        char padding[64];
+    };
+
+    //! The stripes
+    Stripe m_stripes[k_stripes];
+};
+
+inline LatencySketch::LatencySketch(const double relativeAccuracy, const std::size_t maxBins) noexcept
+    : m_gamma((1 + relativeAccuracy) / (1 - relativeAccuracy)),
+      m_logGamma(std::log(m_gamma)),
+      m_minValue(1e-9),
+      m_maxBins(std::max<std::size_t>(maxBins, 1)),
+      m_offset(0),
+      m_zeros(0),
+      m_count(0),
+      m_max(0) {}
+
+inline void LatencySketch::add(const double value) noexcept {
+    m_max = m_count == 0 ? value : std::max(m_max, value);
+    ++m_count;
+    if (!(value > m_minValue)) {
+        ++m_zeros;
+        return;
+    }
+    add(static_cast<int>(std::ceil(std::log(value) / m_logGamma)), 1);
+}
+
+inline void LatencySketch::add(const int index, const uint64_t count) noexcept {
+    if (m_bins.empty()) {
+        m_bins.push_back(count);
+        m_offset = index;
+        return;
+    }
+
+    // Below the range, grow it down unless it is full, in which case the lowest bin takes the values
+    if (index < m_offset) {
+        const auto grown = static_cast<std::size_t>(m_offset - index) + m_bins.size();
+        if (grown > m_maxBins) {
+            m_bins.front() += count;
+            return;
+        }
+        m_bins.insert(m_bins.begin(), static_cast<std::size_t>(m_offset - index), 0);
+        m_offset = index;
+        m_bins.front() += count;
+        return;
+    }
+
+    // Above the range, grow it up and merge the lowest bins if it is full
+    const auto position = static_cast<std::size_t>(index - m_offset);
+    if (position >= m_bins.size()) {
+        m_bins.resize(position + 1, 0);
+        if (m_bins.size() > m_maxBins) {
+            const std::size_t collapsed = m_bins.size() - m_maxBins;
+            uint64_t lowest = 0;
+            for (std::size_t i = 0; i <= collapsed; ++i) {
+                lowest += m_bins[i];
+            }
+            m_bins.erase(m_bins.begin(), m_bins.begin() + static_cast<std::ptrdiff_t>(collapsed));
+            m_bins.front() = lowest;
+            m_offset += static_cast<int>(collapsed);
+        }
+        m_bins[static_cast<std::size_t>(index - m_offset)] += count;
+        return;
+    }
+    m_bins[position] += count;
+}
+
+inline void LatencySketch::merge(const LatencySketch& other) noexcept {
+    if (other.m_count == 0) {
+        return;
+    }
+    m_max = m_count == 0 ? other.m_max : std::max(m_max, other.m_max);
+    m_count += other.m_count;
+    m_zeros += other.m_zeros;
+    for (std::size_t i = 0; i < other.m_bins.size(); ++i) {
+        if (other.m_bins[i] != 0) {
+            add(other.m_offset + static_cast<int>(i), other.m_bins[i]);
+        }
+    }
+}
+
+inline double LatencySketch::quantile(const double quantile) const noexcept {
+    if (m_count == 0) {
+        return 0;
+    }
+
+    // Find the bin holding the value of that rank, whose representative is within the accuracy of every value
+    const double rank = std::max(0., std::min(quantile, 1.)) * static_cast<double>(m_count - 1);
+    uint64_t seen = m_zeros;
+    if (static_cast<double>(seen) > rank) {
+        return std::min(0., m_max);
+    }
+    for (std::size_t i = 0; i < m_bins.size(); ++i) {
+        seen += m_bins[i];
+        if (static_cast<double>(seen) > rank) {
+            const double bound = std::exp(static_cast<double>(m_offset + static_cast<int>(i)) * m_logGamma);
+            return std::min(2 * bound / (m_gamma + 1), m_max);
+        }
+    }
+    return m_max;
+}
+
+inline TimingSketches::TimingSketches(const SketchOptions& options) noexcept : m_options(options) {
+    // Name the percentiles once, without trailing zeros
+    for (const double percentile : m_options.percentiles) {
+        std::string name("p");
+        detail::appendFixed(name, percentile, 3);
+        name.erase(name.find_last_not_of('0') + 1);
+        if (name.back() == '.') {
+            name.pop_back();
+        }
+        m_names.push_back(name);
+    }
+}
+
+inline void TimingSketches::add(const std::string& metric,
+                                const std::size_t nameLength,
+                                const std::size_t typeLength,
+                                const double value) noexcept {
+    auto& stripe = m_stripes[detail::threadIndex() % k_stripes];
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    auto it = stripe.entries.find(metric);
+    if (it == stripe.entries.end()) {
+        const LatencySketch sketch(m_options.relativeAccuracy, m_options.maxBins);
+        it = stripe.entries.emplace(metric, Entry{nameLength, nameLength + typeLength, sketch}).first;
+    }
+    it->second.sketch.add(value);
+}
+
+template <typename Sink>
+inline void TimingSketches::flush(Sink&& sink, const int precision) noexcept {
+    // Swap the stripes out one at a time so that producers are only blocked for the swap, then merge them
+    Table staged;
+    for (auto& stripe : m_stripes) {
+        Table entries;
+        std::unique_lock<std::mutex> lock(stripe.mutex);
+        stripe.entries.swap(entries);
+        lock.unlock();
+
+        if (staged.empty()) {
+            staged.swap(entries);
+            continue;
+        }
+        for (auto& entry : entries) {
+            auto it = staged.find(entry.first);
+            if (it == staged.end()) {
+                staged.emplace(entry.first, std::move(entry.second));
+            } else {
+                it->second.sketch.merge(entry.second.sketch);
+            }
+        }
+    }
+
+    // Emit "prefix.key.name:value|type|#tags" for the percentiles, the maximum and the count
+    std::string line;
+    const auto begin = [&line](const std::string& metric, const Entry& entry, const char* name) {
+        line.assign(metric, 0, entry.nameLength);
+        line.push_back('.');
+        line.append(name);
+        line.push_back(':');
+    };
+    for (const auto& staging : staged) {
+        const auto& entry = staging.second;
+        for (std::size_t i = 0; i < m_names.size(); ++i) {
+            begin(staging.first, entry, m_names[i].c_str());
+            detail::appendFixed(line, entry.sketch.quantile(m_options.percentiles[i] / 100), precision);
+            line.append("|g");
+            line.append(staging.first, entry.tagsOffset, std::string::npos);
+            sink(line);
+        }
+        begin(staging.first, entry, "max");
+        detail::appendFixed(line, entry.sketch.max(), precision);
+        line.append("|g");
+        line.append(staging.first, entry.tagsOffset, std::string::npos);
+        sink(line);
+        begin(staging.first, entry, "count");
+        detail::appendInteger(line, entry.sketch.count());
+        line.append("|c");
+        line.append(staging.first, entry.tagsOffset, std::string::npos);
+        sink(line);
+    }
+}
+
+}  // namespace Statsd
+
+#endif
@@ -0,0 +1,211 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <cpp-statsd-client/Formatter.hpp>
+#include <cpp-statsd-client/Random.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace Statsd {
+
+/*!
+ *
+ * Stats
+ *
+ * A snapshot of the client's own counters, since it was last configured.
+ *
+ */
+struct Stats {
+    //! The number of flush duration buckets
+    static constexpr std::size_t k_flushBuckets{20};
+
+    //! The number of metric lines formatted and handed to the sender, aggregates included
+    uint64_t metricsFormatted = 0;
+
+    //! The number of bytes queued for batching
+    uint64_t bytesQueued = 0;
+
+    //! The number of datagrams sent successfully, or of batches written to a TCP connection
+    uint64_t datagramsSent = 0;
+
+    //! The number of datagrams which failed to be sent, or of failed TCP connections and writes, by errno
+    std::map<int, uint64_t> sendFailures;
+
+    //! The number of messages dropped because the queue was full or the drain timed out
+    uint64_t droppedMessages = 0;
+
+    //! The number of bytes of the dropped messages
+    uint64_t droppedBytes = 0;
+
+    //! The number of messages dropped because they do not fit in a datagram, which are counted as dropped too
+    uint64_t oversizedMessages = 0;
+
+    //! The largest number of bytes the queue held at once
+    uint64_t queueHighWaterMark = 0;
+
+    //! The number of queue flushes by duration: bucket i counts those which took less than 2^i microseconds and
+    //! more than the previous bucket, the last one counts all longer ones
+    std::array<uint64_t, k_flushBuckets> flushDurations{};
+};
+
+namespace detail {
+
+/*!
+ *
+ * Striped counter
+ *
+ * A counter incremented by many threads at once, split into a few
+ * cache lines picked by the thread index, so that threads do not
+ * bounce one cache line between their cores. Reading it sums them.
+ *
+ */
+class StripedCounter {
+public:
+    //! Adds to the counter
+    void add(const uint64_t value) noexcept {
+        m_stripes[threadIndex() % k_stripes].value.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    //! Returns the sum of the stripes
+    uint64_t load() const noexcept {
+        uint64_t sum = 0;
+        for (const auto& stripe : m_stripes) {
+            sum += stripe.value.load(std::memory_order_relaxed);
+        }
+        return sum;
+    }
+
+private:
+    //! The number of stripes
+    static constexpr std::size_t k_stripes{16};
+
+    //! A stripe, padded to the assumed size of a cache line
+    struct Stripe {
+        std::atomic<uint64_t> value{0};
+        char padding[64 - sizeof(std::atomic<uint64_t>)];
+    };
+
+    //! The stripes
+    Stripe m_stripes[k_stripes];
+};
+
+/*!
+ *
+ * Stats reporter
+ *
+ * Turns the successive snapshots of the stats into metric lines under
+ * a reserved prefix: the counters as the increase since the previous
+ * report, the queue high-water mark as a gauge, e.g.
+ * "statsd.client.datagrams_sent:42|c" or
+ * "statsd.client.flushes:3|c|#le_us:1024".
+ *
+ */
+class StatsReporter final {
+public:
+    //! Constructor
+    explicit StatsReporter(const std::string& prefix) noexcept : m_prefix(prefix) {}
+
+    //! Hands the lines reporting the stats to the sink
+    template <typename Sink>
+    void report(const Stats& stats, Sink&& sink) noexcept;
+
+private:
+    //! Hands a counter line to the sink, if the counter increased
+    template <typename Sink>
+    void count(const char* name, const uint64_t value, const uint64_t previous, const std::string& tag, Sink& sink);
+
+    //! The reserved prefix
+    std::string m_prefix;
+
+    //! The stats of the previous report
+    Stats m_previous;
+
+    //! The line being built
+    std::string m_line;
+
+    //! The mutex serializing the reports
+    std::mutex m_mutex;
+};
+
+template <typename Sink>
+inline void StatsReporter::report(const Stats& stats, Sink&& sink) noexcept {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    count("metrics_formatted", stats.metricsFormatted, m_previous.metricsFormatted, std::string(), sink);
+    count("bytes_queued", stats.bytesQueued, m_previous.bytesQueued, std::string(), sink);
+    count("datagrams_sent", stats.datagramsSent, m_previous.datagramsSent, std::string(), sink);
+    for (const auto& failures : stats.sendFailures) {
+        count("send_failures", failures.second, m_previous.sendFailures[failures.first],
+              "errno:" + std::to_string(failures.first), sink);
+    }
+    count("dropped_messages", stats.droppedMessages, m_previous.droppedMessages, std::string(), sink);
+    count("dropped_bytes", stats.droppedBytes, m_previous.droppedBytes, std::string(), sink);
+    count("oversized_messages", stats.oversizedMessages, m_previous.oversizedMessages, std::string(), sink);
+    for (std::size_t i = 0; i < Stats::k_flushBuckets; ++i) {
+        const std::string bound = i + 1 < Stats::k_flushBuckets ? std::to_string(uint64_t{1} << i) : "inf";
+        count("flushes", stats.flushDurations[i], m_previous.flushDurations[i], "le_us:" + bound, sink);
+    }
+
+    m_line.assign(m_prefix);
+    m_line.append(".queue_high_water_mark:");
+    appendInteger(m_line, stats.queueHighWaterMark);
+    m_line.append("|g");
+    sink(m_line);
+
+    m_previous = stats;
+}
+
+template <typename Sink>
+inline void StatsReporter::count(const char* name,
+                                 const uint64_t value,
+                                 const uint64_t previous,
+                                 const std::string& tag,
+                                 Sink& sink) {
+    if (value <= previous) {
+        return;
+    }
+    m_line.assign(m_prefix);
+    m_line.push_back('.');
+    m_line.append(name);
+    m_line.push_back(':');
+    appendInteger(m_line, value - previous);
+    m_line.append("|c");
+    if (!tag.empty()) {
+        m_line.append("|#");
+        m_line.append(tag);
+    }
+    sink(m_line);
+}
+
+//! Add the stats of a shard to those of the others, the high-water mark being the largest of any queue
+inline void accumulate(Stats& total, const Stats& shard) noexcept {
+    total.metricsFormatted += shard.metricsFormatted;
+    total.bytesQueued += shard.bytesQueued;
+    total.datagramsSent += shard.datagramsSent;
+    for (const auto& failures : shard.sendFailures) {
+        total.sendFailures[failures.first] += failures.second;
+    }
+    total.droppedMessages += shard.droppedMessages;
+    total.droppedBytes += shard.droppedBytes;
+    total.oversizedMessages += shard.oversizedMessages;
+    total.queueHighWaterMark = std::max(total.queueHighWaterMark, shard.queueHighWaterMark);
+    for (std::size_t i = 0; i < Stats::k_flushBuckets; ++i) {
+        total.flushDurations[i] += shard.flushDurations[i];
+    }
+}
+
+//! Raise an atomic maximum
+inline void raiseMaximum(std::atomic<uint64_t>& maximum, const uint64_t value) noexcept {
+    uint64_t current = maximum.load(std::memory_order_relaxed);
+    while (value > current && !maximum.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+}  // namespace detail
+}  // namespace Statsd
+
+#endif
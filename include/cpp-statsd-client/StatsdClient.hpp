@@ -1,18 +1,308 @@
 #ifndef STATSD_CLIENT_HPP
 #define STATSD_CLIENT_HPP
 
+#include <cpp-statsd-client/Aggregator.hpp>
+#include <cpp-statsd-client/Formatter.hpp>
+#include <cpp-statsd-client/MetricDefinition.hpp>
+#include <cpp-statsd-client/Random.hpp>
+#include <cpp-statsd-client/RcuPointer.hpp>
+#include <cpp-statsd-client/SetDeduplicator.hpp>
+#include <cpp-statsd-client/Sketch.hpp>
+#include <cpp-statsd-client/StringView.hpp>
+#include <cpp-statsd-client/TagsView.hpp>
+#include <cpp-statsd-client/TickClock.hpp>
 #include <cpp-statsd-client/UDPSender.hpp>
+#include <cpp-statsd-client/ValuePacker.hpp>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <cstdio>
-#include <iomanip>
+#include <cstring>
 #include <memory>
 #include <random>
-#include <sstream>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 namespace Statsd {
 
+/*!
+ *
+ * Client options
+ *
+ * The optional features of the client, all of them are
+ * disabled by default.
+ *
+ */
+struct ClientOptions {
+    //! Aggregate counters and gauges in-process and emit them once per flush
+    bool aggregate = false;
+
+    //! Keep timings in sketches and emit their percentiles, maximum and count once per flush
+    bool sketchTimings = false;
+
+    //! The options of the timing sketches
+    SketchOptions sketch;
+
+    //! Keep the members of sets and emit each distinct member, or an estimate of their number, once per flush
+    bool dedupSets = false;
+
+    //! The options of the set deduplication
+    SetOptions sets;
+
+    //! Keep the values of timings, distributions and histograms and emit those of a metric together once per
+    //! flush, several per line, e.g. "key:1:2:3|ms", which the daemon must support
+    bool packValues = false;
+
+    //! Emit the stats of the client once per flush, under the stats prefix
+    bool emitStats = false;
+
+    //! The reserved prefix of the stats of the client, which does not get the prefix of the client
+    std::string statsPrefix = "statsd.client";
+
+    //! The number of senders the metrics are spread over, each with a queue and a socket of its own
+    std::size_t shards = 1;
+
+    //! Whether each shard has a batching thread of its own, rather than the first one flushing them all
+    bool threadPerShard = true;
+
+    //! The tags added to every metric, e.g. {"host:web-1", "env:prod"}
+    std::vector<std::string> constantTags;
+
+    //! The options of the underlying senders
+    SenderOptions sender;
+};
+
+class StatsdClient;
+
+namespace detail {
+
+//! The parts of a metric line around its value, serialized once: the key and the suffix "|type|#tags"
+struct SerializedMetric {
+    //! The key, without the prefix
+    std::string key;
+
+    //! The type and the tags
+    std::string suffix;
+
+    //! The length of the "|type" part of the suffix, after which the sample rate is inserted
+    std::size_t typeLength;
+
+    //! Returns a view of the parts
+    MetricView view() const noexcept {
+        return {StringView(key), StringView(suffix), typeLength};
+    }
+};
+
+/*!
+ *
+ * Client configuration
+ *
+ * Everything a configuration of the client sets up: the prefix, the
+ * constant tags, the helpers holding metrics back until the flush and
+ * the senders of the shards. The client publishes it as a whole, so
+ * that a metric is always serialized and sent under one configuration.
+ *
+ * Destroying it emits what its helpers held back and drains the queues
+ * of its senders.
+ *
+ */
+struct ClientConfiguration {
+    //! Destructor, emits the aggregated metrics if any, then destroys the senders, the first one first
+    ~ClientConfiguration();
+
+    //! Returns the sender of the shard of the calling thread
+    UDPSender& sender() const noexcept;
+
+    //! Returns true if the senders are initialized
+    bool initialized() const noexcept;
+
+    //! Returns true if some helper holds metrics back until the next flush
+    bool holdsMetrics() const noexcept;
+
+    //! Flush the helpers and the queues of the senders, the first sender flushing the helpers
+    void flush() const noexcept;
+
+    //! The prefix to be used for metrics
+    std::string prefix;
+
+    //! The constant tags joined after "|#", and after "," for the metrics which have tags of their own
+    std::string constantTags;
+    std::string moreConstantTags;
+
+    //! Fixed floating point precision of gauges
+    int gaugePrecision = 4;
+
+    //! The aggregated counters and gauges, when aggregation is enabled
+    std::unique_ptr<Aggregator> aggregator;
+
+    //! The sketched timings, when sketching is enabled
+    std::unique_ptr<TimingSketches> sketches;
+
+    //! The deduplicated sets, when deduplication is enabled
+    std::unique_ptr<SetDeduplicator> sets;
+
+    //! The packed values of timings and distributions, when packing is enabled
+    std::unique_ptr<ValuePacker> values;
+
+    //! The reporter of the stats of the client, when they are emitted
+    std::unique_ptr<StatsReporter> statsReporter;
+
+    //! The UDP senders to be used for actual sending, one per shard
+    std::vector<std::unique_ptr<UDPSender>> senders;
+};
+
+}  // namespace detail
+
+/*!
+ *
+ * Counter
+ *
+ * A counter registered with the client. Its key, type and tags are
+ * serialized once when registering it, so that counting only formats
+ * the delta. The prefix is not part of the handle, it always follows
+ * the configuration of the client. A handle must not outlive the
+ * client it was registered with.
+ *
+ */
+class Counter {
+public:
+    //! Increments the counter, at a given frequency rate
+    void increment(float frequency = 1.0f) const noexcept;
+
+    //! Decrements the counter, at a given frequency rate
+    void decrement(float frequency = 1.0f) const noexcept;
+
+    //! Adjusts the counter by a given delta, at a given frequency rate
+    void count(const int delta, float frequency = 1.0f) const noexcept;
+
+private:
+    friend class StatsdClient;
+
+    //! Constructor, for the client only
+    Counter(const StatsdClient& client, detail::SerializedMetric metric) noexcept;
+
+    //! The client recording the counter
+    const StatsdClient* m_client;
+
+    //! The serialized metric
+    detail::SerializedMetric m_metric;
+};
+
+/*!
+ *
+ * Metric handle
+ *
+ * A metric of any type registered with the client, which works like
+ * a counter handle: recording a value only formats the value. Gauges,
+ * timings and sets are aggregated, sketched and deduplicated like those
+ * recorded with the gauge, timing and set methods, any other type is
+ * sent like those recorded with the custom method.
+ *
+ */
+class MetricHandle {
+public:
+    //! Records a value, at a given frequency rate
+    template <typename T>
+    void record(const T value, float frequency = 1.0f) const noexcept;
+
+private:
+    friend class StatsdClient;
+
+    //! The types of metrics which the client may keep rather than send
+    enum class Kind { Gauge, Timing, Set, Other };
+
+    //! Constructor, for the client only
+    MetricHandle(const StatsdClient& client, detail::SerializedMetric metric, const Kind kind) noexcept;
+
+    //! The client recording the metric
+    const StatsdClient* m_client;
+
+    //! The serialized metric
+    detail::SerializedMetric m_metric;
+
+    //! The type of the metric
+    Kind m_kind;
+};
+
+/*!
+ *
+ * Scoped timer
+ *
+ * Times the scope it lives in and records the time as a timing, in
+ * fractional milliseconds, when it is stopped or destroyed, unless it
+ * is cancelled. The ticks are those of detail::TickClock.
+ *
+ * Whether the timing is sampled is decided when the timer starts, so
+ * that a timer which is not sampled reads no clock at all, and does
+ * not even serialize its key. A timer started while timings are
+ * sketched is kept unless its frequency is 0, and is sampled when it
+ * stops should the configuration no longer sketch them by then. Like
+ * a handle, a timer must not outlive the client which started it.
+ *
+ */
+class ScopedTimer {
+public:
+    //!@name Move constructor and destructor, non-copyable
+    //!@{
+
+    //! Move constructor, the other timer is left cancelled
+    ScopedTimer(ScopedTimer&& other) noexcept;
+
+    //! Destructor, records the timing unless stopped or cancelled already
+    ~ScopedTimer();
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(ScopedTimer&&) = delete;
+
+    //!@}
+
+    //!@name Methods
+    //!@{
+
+    //! Records the time elapsed until now, once
+    void stop() noexcept;
+
+    //! Records nothing
+    void cancel() noexcept;
+
+    //!@}
+
+private:
+    friend class StatsdClient;
+
+    //! Constructor, for the client only, which starts the timer if it is sampled
+    ScopedTimer(const StatsdClient& client, float frequency) noexcept;
+
+    //! Start ticking
+    void start() noexcept;
+
+    //! The client recording the timing
+    const StatsdClient* m_client;
+
+    //! The metric serialized by the timer, when it was given a key
+    detail::SerializedMetric m_ownMetric;
+
+    //! The metric laid out at compile time, otherwise
+    detail::MetricView m_metric;
+
+    //! Whether the timer serialized the metric
+    bool m_ownsMetric;
+
+    //! The frequency the timing is sampled at
+    float m_frequency;
+
+    //! Whether the timing was sampled when the timer started, which it is not when it is sketched
+    bool m_sampled;
+
+    //! Whether the timing is to be recorded
+    bool m_running;
+
+    //! The tick the timer started at
+    uint64_t m_start;
+};
+
 /*!
  *
  * Statsd client
@@ -28,7 +318,8 @@ namespace Statsd {
  *
  * The sampling frequency is specified per call and uses a
  * random number generator to determine whether or not the stat
- * will be recorded this time or not.
+ * will be recorded this time or not. Each thread draws from its
+ * own generator, seeded from the client seed and the thread.
  *
  * The top level configuration includes 2 optional parameters
  * that determine how the stats are delivered to statsd. These
@@ -54,6 +345,46 @@ namespace Statsd {
  * queue until the caller manually flushes the queue via the
  * flush method.
  *
+ * The client can optionally aggregate counters and gauges in-
+ * process. Each distinct metric (prefixed key, type and tags) is
+ * then emitted once per flush, counters being summed and gauges
+ * keeping the last written value. The aggregates are flushed by
+ * the batching thread every send interval, or by the flush method
+ * otherwise. Since aggregating is cheap and loses no accuracy, the
+ * sampling frequency is ignored for aggregated metrics.
+ *
+ * Metrics recorded over and over can be registered up front with the
+ * counter and metric methods. The returned handles keep the key, type
+ * and tags serialized, which saves serializing them on every call.
+ * Metrics whose key, type and tags are known at compile time can be
+ * defined as types instead, see Metric, and recorded with the record
+ * method, which leaves nothing but the value to format.
+ *
+ * Scopes can be timed with the time methods, which return a timer
+ * recording the time it lived, in fractional milliseconds.
+ *
+ * The values of timings, distributions and histograms can be packed
+ * too: those recorded for a metric until the next flush go out
+ * together, several per line, within the size of a batch.
+ *
+ * Tags which every metric carries, such as the host or the service,
+ * can be configured once as constant tags. They are joined when the
+ * client is configured, and appended after the tags of each metric.
+ *
+ * On hosts with many cores, the metrics can be spread over several
+ * shards, each a sender with its own queue, socket and, optionally,
+ * batching thread. A thread always sends through the same shard, picked
+ * by its index, so that threads on different cores mostly work on
+ * different queues. The first shard emits what the client holds back
+ * until the flush, and reports the stats of all of them.
+ *
+ * The client can be reconfigured while other threads record metrics.
+ * The new configuration is built aside and published at once, each
+ * call recording under either the previous configuration or the new
+ * one, never a mix. The previous senders drain their queues once no
+ * call holds them anymore, so that nothing queued is lost, and calls
+ * never take a lock for this, see detail::RcuPointer.
+ *
  */
 class StatsdClient {
 public:
@@ -66,7 +397,11 @@ public:
                  const std::string& prefix,
                  const uint64_t batchsize = 0,
                  const uint64_t sendInterval = 1000,
-                 const int gaugePrecision = 4) noexcept;
+                 const int gaugePrecision = 4,
+                 const ClientOptions& options = ClientOptions()) noexcept;
+
+    //! Destructor, emits the aggregated metrics if any
+    ~StatsdClient();
 
     StatsdClient(const StatsdClient&) = delete;
     StatsdClient& operator=(const StatsdClient&) = delete;
@@ -76,59 +411,95 @@ public:
     //!@name Methods
     //!@{
 
-    //! Sets a configuration
+    //! Sets a configuration, emitting and draining what was recorded under the previous one
     void setConfig(const std::string& host,
                    const uint16_t port,
                    const std::string& prefix,
                    const uint64_t batchsize = 0,
                    const uint64_t sendInterval = 1000,
-                   const int gaugePrecision = 4) noexcept;
+                   const int gaugePrecision = 4,
+                   const ClientOptions& options = ClientOptions()) noexcept;
+
+    //! Returns the error messages of the senders of the shards, joined by "; ", empty if none failed
+    std::string errorMessage() const noexcept;
 
-    //! Returns the error message as an std::string
-    const std::string& errorMessage() const noexcept;
+    //! Returns the number of metrics dropped by the sender since the last configuration
+    uint64_t droppedMessages() const noexcept;
+
+    //! Returns the number of bytes of the metrics dropped by the sender since the last configuration
+    uint64_t droppedBytes() const noexcept;
+
+    //! Returns a snapshot of the stats of the client since the last configuration
+    Stats stats() const noexcept;
 
     //! Increments the key, at a given frequency rate
-    void increment(const std::string& key,
+    void increment(const StringView key,
                    float frequency = 1.0f,
-                   const std::vector<std::string>& tags = {}) const noexcept;
+                   const TagsView& tags = {}) const noexcept;
 
     //! Increments the key, at a given frequency rate
-    void decrement(const std::string& key,
+    void decrement(const StringView key,
                    float frequency = 1.0f,
-                   const std::vector<std::string>& tags = {}) const noexcept;
+                   const TagsView& tags = {}) const noexcept;
 
     //! Adjusts the specified key by a given delta, at a given frequency rate
-    void count(const std::string& key,
+    void count(const StringView key,
                const int delta,
                float frequency = 1.0f,
-               const std::vector<std::string>& tags = {}) const noexcept;
+               const TagsView& tags = {}) const noexcept;
 
     //! Records a gauge for the key, with a given value, at a given frequency rate
     template <typename T>
-    void gauge(const std::string& key,
+    void gauge(const StringView key,
                const T value,
                float frequency = 1.0f,
-               const std::vector<std::string>& tags = {}) const noexcept;
+               const TagsView& tags = {}) const noexcept;
 
     //! Records a timing for a key, at a given frequency
-    void timing(const std::string& key,
+    void timing(const StringView key,
                 const unsigned int ms,
                 float frequency = 1.0f,
-                const std::vector<std::string>& tags = {}) const noexcept;
+                const TagsView& tags = {}) const noexcept;
+
+    //! Records a timing for a key from a duration, in fractional milliseconds, at a given frequency
+    template <typename Rep, typename Period>
+    void timing(const StringView key,
+                const std::chrono::duration<Rep, Period> duration,
+                float frequency = 1.0f,
+                const TagsView& tags = {}) const noexcept;
+
+    //! Starts timing the scope for a key, at a given frequency, see ScopedTimer
+    ScopedTimer time(const StringView key, float frequency = 1.0f, const TagsView& tags = {}) const noexcept;
+
+    //! Starts timing the scope for a timing defined at compile time, at a given frequency
+    template <typename Definition>
+    ScopedTimer time(float frequency = 1.0f) const noexcept;
 
     //! Records a count of unique occurrences for a key, at a given frequency
-    void set(const std::string& key,
+    void set(const StringView key,
              const unsigned int sum,
              float frequency = 1.0f,
-             const std::vector<std::string>& tags = {}) const noexcept;
+             const TagsView& tags = {}) const noexcept;
 
     //! Records a custom metric type for the key, with a given value, at a given frequency
     template <typename T>
-    void custom(const std::string& key,
+    void custom(const StringView key,
                 const T value,
                 const char* type,
                 float frequency = 1.0f,
-                const std::vector<std::string>& tags = {}) const noexcept;
+                const TagsView& tags = {}) const noexcept;
+
+    //! Registers a counter for the key, returning a handle to count cheaply
+    Counter counter(const StringView key, const TagsView& tags = {}) const noexcept;
+
+    //! Registers a metric of the given type for the key, returning a handle to record values cheaply
+    MetricHandle metric(const StringView key,
+                        const char* type,
+                        const TagsView& tags = {}) const noexcept;
+
+    //! Records a value for a metric defined at compile time, see Metric, at a given frequency rate
+    template <typename Definition, typename T>
+    void record(const T value, float frequency = 1.0f) const noexcept;
 
     //! Seed the RNG that controls sampling
     void seed(unsigned int seed = std::random_device()()) noexcept;
@@ -139,31 +510,173 @@ public:
     //!@}
 
 private:
+    friend class Counter;
+    friend class MetricHandle;
+    friend class ScopedTimer;
+
+    //! The configuration, as pinned by the calls which record metrics
+    using Configuration = detail::ClientConfiguration;
+    using PinnedConfiguration = detail::RcuPointer<Configuration>::Reader;
+
     // @name Private methods
     // @{
 
-    //! Send a value for a key, according to its type, at a given frequency
+    //! Send a value for a serialized metric, at a given frequency
     template <typename T>
-    void send(const std::string& key,
+    void send(const Configuration& config,
+              const detail::MetricView& metric,
               const T value,
-              const char* type,
-              float frequency,
-              const std::vector<std::string>& tags) const noexcept;
+              float frequency) const noexcept;
+
+    //! Returns true if a metric is sampled at the frequency, which is clamped to [0, 1]
+    bool sample(float& frequency) const noexcept;
+
+    //! Returns true if a metric is never sampled at the frequency, i.e. at 0 or below
+    static bool neverSampled(const float frequency) noexcept;
+
+    //! Format and send a value for a serialized metric which was sampled already
+    template <typename T>
+    void emit(const Configuration& config,
+              const detail::MetricView& metric,
+              const T value,
+              const float frequency) const noexcept;
+
+    //! Returns true if a timing at the frequency is to be recorded, telling whether it was sampled already
+    bool keepsTiming(float& frequency, bool& sampled) const noexcept;
+
+    //! Record a timing in milliseconds, sketching it when enabled and sampling it first unless it was already
+    void recordTiming(const detail::MetricView& metric,
+                      const double ms,
+                      float frequency,
+                      const bool sampled) const noexcept;
+
+    //! Adjust a serialized counter by a given delta, aggregating it when enabled
+    void count(const Configuration& config,
+               const detail::MetricView& metric,
+               const int delta,
+               float frequency) const noexcept;
+
+    //! Record a value for a serialized gauge, aggregating it when enabled
+    template <typename T>
+    void gauge(const Configuration& config,
+               const detail::MetricView& metric,
+               const T value,
+               float frequency) const noexcept;
+
+    //! Record a value for a serialized timing, sketching it when enabled
+    template <typename T>
+    void timing(const Configuration& config,
+                const detail::MetricView& metric,
+                const T value,
+                float frequency) const noexcept;
+
+    //! Record a member for a serialized set, deduplicating it when enabled
+    template <typename T>
+    void set(const Configuration& config,
+             const detail::MetricView& metric,
+             const T value,
+             float frequency) const noexcept;
+
+    //! Record a value for a serialized metric the way its type is recorded, the types being told apart at compile time
+    template <typename T>
+    void record(const Configuration& config,
+                const detail::MetricView& metric,
+                const T value,
+                float frequency,
+                metric::Count) const noexcept;
+    template <typename T>
+    void record(const Configuration& config,
+                const detail::MetricView& metric,
+                const T value,
+                float frequency,
+                metric::Gauge) const noexcept;
+    template <typename T>
+    void record(const Configuration& config,
+                const detail::MetricView& metric,
+                const T value,
+                float frequency,
+                metric::Timing) const noexcept;
+    template <typename T>
+    void record(const Configuration& config,
+                const detail::MetricView& metric,
+                const T value,
+                float frequency,
+                metric::Set) const noexcept;
+    template <typename T, typename Type>
+    void record(const Configuration& config,
+                const detail::MetricView& metric,
+                const T value,
+                float frequency,
+                Type) const noexcept;
+
+    //! Add a value to the sketch of a serialized timing, which only takes numbers
+    void sketch(const Configuration& config, const detail::MetricView& metric, const double value) const noexcept;
+
+    //! Serialize the key, type and tags of a metric
+    static void serialize(detail::SerializedMetric& metric,
+                          const StringView key,
+                          const char* type,
+                          const TagsView& tags) noexcept;
+
+    //! Serialize the key, type and tags of a metric into a thread local buffer and return it
+    static const detail::SerializedMetric& serialize(const StringView key,
+                                                     const char* type,
+                                                     const TagsView& tags) noexcept;
+
+    //! Serialize the metric without its value, i.e. "prefix.key|type|#tags", into a thread local buffer
+    //! The sample rate goes in too if the frequency is below 1
+    static const std::string& aggregationKey(const Configuration& config,
+                                             const detail::MetricView& metric,
+                                             std::size_t& nameLength,
+                                             const float frequency = 1.f) noexcept;
+
+    //! Format a value with the configured precision into a thread local buffer and return it
+    template <typename T>
+    static const std::string& formatValue(const Configuration& config, const T value) noexcept;
+
+    //! Append the prefixed key to the buffer
+    static void appendName(const Configuration& config, std::string& buffer, const StringView key) noexcept;
+
+    //! Append the suffix of a metric and the constant tags to the buffer, the sample rate in between if any
+    static void appendSuffix(const Configuration& config,
+                             std::string& buffer,
+                             const detail::MetricView& metric,
+                             const float frequency) noexcept;
+
+    //! Build a configuration, its helpers and its senders
+    static std::unique_ptr<Configuration> makeConfiguration(const std::string& host,
+                                                            const uint16_t port,
+                                                            const std::string& prefix,
+                                                            const uint64_t batchsize,
+                                                            const uint64_t sendInterval,
+                                                            const int gaugePrecision,
+                                                            const ClientOptions& options) noexcept;
+
+    //! Join the constant tags once for all
+    static void serializeConstantTags(Configuration& config, const std::vector<std::string>& tags) noexcept;
+
+    //! Create the helpers holding metrics back until the next flush, as enabled by the options
+    static void makeHelpers(Configuration& config, const ClientOptions& options) noexcept;
+
+    //! Create the UDP senders of the shards for the given configuration
+    static void makeSenders(Configuration& config,
+                            const std::string& host,
+                            const uint16_t port,
+                            const uint64_t batchsize,
+                            const uint64_t sendInterval,
+                            const ClientOptions& options) noexcept;
 
     //!@}
 
 private:
-    //! The prefix to be used for metrics
-    std::string m_prefix;
+    //! The published configuration, replaced as a whole by setConfig
+    detail::RcuPointer<Configuration> m_config;
 
-    //! The UDP sender to be used for actual sending
-    std::unique_ptr<UDPSender> m_sender;
+    //! The seed of the per-thread random number generators for handling sampling
+    std::atomic<uint64_t> m_seed;
 
-    //! The random number generator for handling sampling
-    mutable std::mt19937 m_randomEngine;
-
-    //! Fixed floating point precision of gauges
-    int m_gaugePrecision;
+    //! The sequence of draws started by the last seeding, see detail::threadGenerator
+    std::atomic<uint64_t> m_randomStream;
 };
 
 namespace detail {
@@ -174,12 +687,37 @@ inline std::string sanitizePrefix(std::string prefix) {
     }
     return prefix;
 }
+inline ClientConfiguration::~ClientConfiguration() {
+    // Emit what was aggregated since the last flush
+    if (holdsMetrics()) {
+        flush();
+    }
+    // The final flush of the first sender flushes the other shards, which are still alive at that point
+    if (!senders.empty()) {
+        senders.front().reset();
+    }
+    senders.clear();
+}
+
+inline UDPSender& ClientConfiguration::sender() const noexcept {
+    return *senders[senders.size() == 1 ? 0 : threadIndex() % senders.size()];
+}
+
+inline bool ClientConfiguration::initialized() const noexcept {
+    return senders.front()->initialized();
+}
+
+inline bool ClientConfiguration::holdsMetrics() const noexcept {
+    return aggregator || sketches || sets || values || statsReporter;
+}
+
+inline void ClientConfiguration::flush() const noexcept {
+    // The first sender emits the aggregates, if any, before flushing its queue, then the other shards follow
+    for (const auto& sender : senders) {
+        sender->flush();
+    }
+}
 
-// All supported metric types
-constexpr char METRIC_TYPE_COUNT[] = "c";
-constexpr char METRIC_TYPE_GAUGE[] = "g";
-constexpr char METRIC_TYPE_TIMING[] = "ms";
-constexpr char METRIC_TYPE_SET[] = "s";
 }  // namespace detail
 
 inline StatsdClient::StatsdClient(const std::string& host,
@@ -187,104 +725,458 @@ inline StatsdClient::StatsdClient(const std::string& host,
                                   const std::string& prefix,
                                   const uint64_t batchsize,
                                   const uint64_t sendInterval,
-                                  const int gaugePrecision) noexcept
-    : m_prefix(detail::sanitizePrefix(prefix)),
-      m_sender(new UDPSender{host, port, batchsize, sendInterval}),
-      m_gaugePrecision(gaugePrecision) {
+                                  const int gaugePrecision,
+                                  const ClientOptions& options) noexcept
+    : m_config(makeConfiguration(host, port, prefix, batchsize, sendInterval, gaugePrecision, options)) {
     // Initialize the random generator to be used for sampling
     seed();
+
+    // Calibrate the clock of the timers here rather than in the first one
+    detail::TickClock::calibrate();
 }
 
+inline StatsdClient::~StatsdClient() = default;
+
 inline void StatsdClient::setConfig(const std::string& host,
                                     const uint16_t port,
                                     const std::string& prefix,
                                     const uint64_t batchsize,
                                     const uint64_t sendInterval,
-                                    const int gaugePrecision) noexcept {
-    m_prefix = detail::sanitizePrefix(prefix);
-    m_sender.reset(new UDPSender(host, port, batchsize, sendInterval));
-    m_gaugePrecision = gaugePrecision;
+                                    const int gaugePrecision,
+                                    const ClientOptions& options) noexcept {
+    // The new configuration is built aside, the producers keep sending under the previous one meanwhile
+    auto next = makeConfiguration(host, port, prefix, batchsize, sendInterval, gaugePrecision, options);
+
+    // Once no producer holds the previous configuration, destroying it emits and drains what it held
+    m_config.exchange(std::move(next)).reset();
+}
+
+inline std::unique_ptr<detail::ClientConfiguration> StatsdClient::makeConfiguration(
+    const std::string& host,
+    const uint16_t port,
+    const std::string& prefix,
+    const uint64_t batchsize,
+    const uint64_t sendInterval,
+    const int gaugePrecision,
+    const ClientOptions& options) noexcept {
+    std::unique_ptr<Configuration> config(new Configuration);
+    config->prefix = detail::sanitizePrefix(prefix);
+    config->gaugePrecision = gaugePrecision;
+    serializeConstantTags(*config, options.constantTags);
+    makeHelpers(*config, options);
+    makeSenders(*config, host, port, batchsize, sendInterval, options);
+    return config;
+}
+
+inline void StatsdClient::serializeConstantTags(Configuration& config, const std::vector<std::string>& tags) noexcept {
+    if (tags.empty()) {
+        return;
+    }
+    config.constantTags.assign("|#");
+    TagsView(tags).appendTo(config.constantTags);
+    config.moreConstantTags.assign(1, ',');
+    config.moreConstantTags.append(config.constantTags, 2, std::string::npos);
+}
+
+inline void StatsdClient::makeHelpers(Configuration& config, const ClientOptions& options) noexcept {
+    config.aggregator.reset(options.aggregate ? new Aggregator : nullptr);
+    config.sketches.reset(options.sketchTimings ? new TimingSketches(options.sketch) : nullptr);
+    config.sets.reset(options.dedupSets ? new SetDeduplicator(options.sets) : nullptr);
+    config.values.reset(options.packValues ? new ValuePacker : nullptr);
+    config.statsReporter.reset(options.emitStats ? new detail::StatsReporter(options.statsPrefix) : nullptr);
+}
+
+inline void StatsdClient::makeSenders(Configuration& config,
+                                      const std::string& host,
+                                      const uint16_t port,
+                                      const uint64_t batchsize,
+                                      const uint64_t sendInterval,
+                                      const ClientOptions& options) noexcept {
+    // The other shards are made first, flushed by their own thread or by the first one, which is destroyed
+    // first too so that its final flush still finds them alive
+    const std::size_t shards = std::max<std::size_t>(options.shards, 1);
+    const uint64_t shardInterval = options.threadPerShard ? sendInterval : 0;
+    std::vector<std::unique_ptr<UDPSender>> senders(shards);
+    std::vector<UDPSender*> others;
+    for (std::size_t shard = 1; shard < shards; ++shard) {
+        senders[shard].reset(new UDPSender{host, port, batchsize, shardInterval, options.sender});
+        others.push_back(senders[shard].get());
+    }
+
+    UDPSender::FlushCallback flushCallback;
+    if (config.holdsMetrics() || (!options.threadPerShard && !others.empty())) {
+        // The aggregates are emitted through the first sender right before it flushes its queue
+        const bool flushOthers = !options.threadPerShard;
+        const Configuration* helpers = &config;
+        flushCallback = [helpers, others, flushOthers](UDPSender& sender) {
+            const auto sink = [&sender](const std::string& line) { sender.send(line); };
+            if (helpers->aggregator) {
+                helpers->aggregator->flush(sink);
+            }
+            if (helpers->sketches) {
+                helpers->sketches->flush(sink, helpers->gaugePrecision);
+            }
+            if (helpers->sets) {
+                helpers->sets->flush(sink);
+            }
+            if (helpers->values) {
+                helpers->values->flush(sink);
+            }
+            if (helpers->statsReporter) {
+                Stats stats = sender.stats();
+                for (const auto other : others) {
+                    detail::accumulate(stats, other->stats());
+                }
+                helpers->statsReporter->report(stats, sink);
+            }
+            if (flushOthers) {
+                for (const auto other : others) {
+                    other->flush();
+                }
+            }
+        };
+    }
+    senders[0].reset(new UDPSender{host, port, batchsize, sendInterval, options.sender, std::move(flushCallback)});
+    config.senders.swap(senders);
+}
+
+inline std::string StatsdClient::errorMessage() const noexcept {
+    // The messages are copied while the configuration is pinned, as a new one may replace it right after
+    const PinnedConfiguration config(m_config);
+    std::string message;
+    for (const auto& sender : config->senders) {
+        const auto& error = sender->errorMessage();
+        if (!error.empty()) {
+            if (!message.empty()) {
+                message.append("; ");
+            }
+            message.append(error);
+        }
+    }
+    return message;
 }
 
-inline const std::string& StatsdClient::errorMessage() const noexcept {
-    return m_sender->errorMessage();
+inline uint64_t StatsdClient::droppedMessages() const noexcept {
+    const PinnedConfiguration config(m_config);
+    uint64_t dropped = 0;
+    for (const auto& sender : config->senders) {
+        dropped += sender->droppedMessages();
+    }
+    return dropped;
+}
+
+inline uint64_t StatsdClient::droppedBytes() const noexcept {
+    const PinnedConfiguration config(m_config);
+    uint64_t dropped = 0;
+    for (const auto& sender : config->senders) {
+        dropped += sender->droppedBytes();
+    }
+    return dropped;
 }
 
-inline void StatsdClient::decrement(const std::string& key,
+inline Stats StatsdClient::stats() const noexcept {
+    const PinnedConfiguration config(m_config);
+    Stats stats;
+    for (const auto& sender : config->senders) {
+        detail::accumulate(stats, sender->stats());
+    }
+    return stats;
+}
+
+inline void StatsdClient::decrement(const StringView key,
                                     float frequency,
-                                    const std::vector<std::string>& tags) const noexcept {
+                                    const TagsView& tags) const noexcept {
     count(key, -1, frequency, tags);
 }
 
-inline void StatsdClient::increment(const std::string& key,
+inline void StatsdClient::increment(const StringView key,
                                     float frequency,
-                                    const std::vector<std::string>& tags) const noexcept {
+                                    const TagsView& tags) const noexcept {
     count(key, 1, frequency, tags);
 }
 
-inline void StatsdClient::count(const std::string& key,
+inline void StatsdClient::count(const StringView key,
                                 const int delta,
                                 float frequency,
-                                const std::vector<std::string>& tags) const noexcept {
-    send(key, delta, detail::METRIC_TYPE_COUNT, frequency, tags);
+                                const TagsView& tags) const noexcept {
+    const PinnedConfiguration config(m_config);
+    count(*config, serialize(key, detail::METRIC_TYPE_COUNT, tags).view(), delta, frequency);
 }
 
 template <typename T>
-inline void StatsdClient::gauge(const std::string& key,
+inline void StatsdClient::gauge(const StringView key,
                                 const T value,
                                 const float frequency,
-                                const std::vector<std::string>& tags) const noexcept {
-    send(key, value, detail::METRIC_TYPE_GAUGE, frequency, tags);
+                                const TagsView& tags) const noexcept {
+    const PinnedConfiguration config(m_config);
+    gauge(*config, serialize(key, detail::METRIC_TYPE_GAUGE, tags).view(), value, frequency);
 }
 
-inline void StatsdClient::timing(const std::string& key,
+inline void StatsdClient::timing(const StringView key,
                                  const unsigned int ms,
                                  float frequency,
-                                 const std::vector<std::string>& tags) const noexcept {
-    send(key, ms, detail::METRIC_TYPE_TIMING, frequency, tags);
+                                 const TagsView& tags) const noexcept {
+    const PinnedConfiguration config(m_config);
+    timing(*config, serialize(key, detail::METRIC_TYPE_TIMING, tags).view(), ms, frequency);
+}
+
+template <typename Rep, typename Period>
+inline void StatsdClient::timing(const StringView key,
+                                 const std::chrono::duration<Rep, Period> duration,
+                                 float frequency,
+                                 const TagsView& tags) const noexcept {
+    const double ms = std::chrono::duration<double, std::milli>(duration).count();
+    const PinnedConfiguration config(m_config);
+    timing(*config, serialize(key, detail::METRIC_TYPE_TIMING, tags).view(), ms, frequency);
 }
 
-inline void StatsdClient::set(const std::string& key,
+inline ScopedTimer StatsdClient::time(const StringView key, float frequency, const TagsView& tags) const noexcept {
+    // The key is only serialized for the timers which are sampled
+    ScopedTimer timer(*this, frequency);
+    if (timer.m_running) {
+        serialize(timer.m_ownMetric, key, detail::METRIC_TYPE_TIMING, tags);
+        timer.m_ownsMetric = true;
+        timer.start();
+    }
+    return timer;
+}
+
+template <typename Definition>
+inline ScopedTimer StatsdClient::time(float frequency) const noexcept {
+    static_assert(std::is_same<typename Definition::type, metric::Timing>::value, "Only timings can be timed");
+    ScopedTimer timer(*this, frequency);
+    if (timer.m_running) {
+        timer.m_metric = detail::MetricLayout<Definition>::view();
+        timer.start();
+    }
+    return timer;
+}
+
+inline void StatsdClient::set(const StringView key,
                               const unsigned int sum,
                               float frequency,
-                              const std::vector<std::string>& tags) const noexcept {
-    send(key, sum, detail::METRIC_TYPE_SET, frequency, tags);
+                              const TagsView& tags) const noexcept {
+    const PinnedConfiguration config(m_config);
+    set(*config, serialize(key, detail::METRIC_TYPE_SET, tags).view(), sum, frequency);
 }
 
 template <typename T>
-inline void StatsdClient::custom(const std::string& key,
+inline void StatsdClient::custom(const StringView key,
                                  const T value,
                                  const char* type,
                                  const float frequency,
-                                 const std::vector<std::string>& tags) const noexcept {
-    send(key, value, type, frequency, tags);
+                                 const TagsView& tags) const noexcept {
+    const PinnedConfiguration config(m_config);
+    send(*config, serialize(key, type, tags).view(), value, frequency);
+}
+
+inline Counter StatsdClient::counter(const StringView key, const TagsView& tags) const noexcept {
+    detail::SerializedMetric metric;
+    serialize(metric, key, detail::METRIC_TYPE_COUNT, tags);
+    return Counter(*this, std::move(metric));
+}
+
+inline MetricHandle StatsdClient::metric(const StringView key,
+                                         const char* type,
+                                         const TagsView& tags) const noexcept {
+    detail::SerializedMetric metric;
+    serialize(metric, key, type, tags);
+    auto kind = MetricHandle::Kind::Other;
+    if (std::strcmp(type, detail::METRIC_TYPE_GAUGE) == 0) {
+        kind = MetricHandle::Kind::Gauge;
+    } else if (std::strcmp(type, detail::METRIC_TYPE_TIMING) == 0) {
+        kind = MetricHandle::Kind::Timing;
+    } else if (std::strcmp(type, detail::METRIC_TYPE_SET) == 0) {
+        kind = MetricHandle::Kind::Set;
+    }
+    return MetricHandle(*this, std::move(metric), kind);
+}
+
+template <typename Definition, typename T>
+inline void StatsdClient::record(const T value, float frequency) const noexcept {
+    // The layout is a constant, only the value is formatted
+    const PinnedConfiguration config(m_config);
+    record(*config, detail::MetricLayout<Definition>::view(), value, frequency, typename Definition::type());
+}
+
+template <typename T>
+inline void StatsdClient::record(const Configuration& config,
+                                 const detail::MetricView& metric,
+                                 const T value,
+                                 float frequency,
+                                 metric::Count) const noexcept {
+    count(config, metric, static_cast<int>(value), frequency);
+}
+
+template <typename T>
+inline void StatsdClient::record(const Configuration& config,
+                                 const detail::MetricView& metric,
+                                 const T value,
+                                 float frequency,
+                                 metric::Gauge) const noexcept {
+    gauge(config, metric, value, frequency);
+}
+
+template <typename T>
+inline void StatsdClient::record(const Configuration& config,
+                                 const detail::MetricView& metric,
+                                 const T value,
+                                 float frequency,
+                                 metric::Timing) const noexcept {
+    timing(config, metric, value, frequency);
+}
+
+template <typename T>
+inline void StatsdClient::record(const Configuration& config,
+                                 const detail::MetricView& metric,
+                                 const T value,
+                                 float frequency,
+                                 metric::Set) const noexcept {
+    set(config, metric, value, frequency);
+}
+
+template <typename T, typename Type>
+inline void StatsdClient::record(const Configuration& config,
+                                 const detail::MetricView& metric,
+                                 const T value,
+                                 float frequency,
+                                 Type) const noexcept {
+    send(config, metric, value, frequency);
+}
+
+inline void StatsdClient::count(const Configuration& config,
+                                const detail::MetricView& metric,
+                                const int delta,
+                                float frequency) const noexcept {
+    // Aggregated counters are summed until the next flush, whatever the frequency unless it drops them all
+    if (config.aggregator) {
+        if (config.initialized() && !neverSampled(frequency)) {
+            std::size_t nameLength;
+            const auto& key = aggregationKey(config, metric, nameLength);
+            config.aggregator->count(key, nameLength, delta);
+        }
+        return;
+    }
+
+    send(config, metric, delta, frequency);
+}
+
+template <typename T>
+inline void StatsdClient::gauge(const Configuration& config,
+                                const detail::MetricView& metric,
+                                const T value,
+                                float frequency) const noexcept {
+    // Aggregated gauges keep the last value until the next flush, whatever the frequency unless it drops them all
+    if (config.aggregator) {
+        if (config.initialized() && !neverSampled(frequency)) {
+            std::size_t nameLength;
+            const auto& key = aggregationKey(config, metric, nameLength);
+            config.aggregator->gauge(key, nameLength, formatValue(config, value));
+        }
+        return;
+    }
+
+    send(config, metric, value, frequency);
 }
 
 template <typename T>
-inline void StatsdClient::send(const std::string& key,
+inline void StatsdClient::timing(const Configuration& config,
+                                 const detail::MetricView& metric,
+                                 const T value,
+                                 float frequency) const noexcept {
+    // Sketched timings are all kept until the next flush, whatever the frequency unless it drops them all
+    if (config.sketches && !std::is_same<detail::ValueCategory<T>, detail::StreamedValue>::value) {
+        if (!neverSampled(frequency)) {
+            sketch(config, metric, detail::toDouble(value, detail::ValueCategory<T>()));
+        }
+        return;
+    }
+
+    send(config, metric, value, frequency);
+}
+
+template <typename T>
+inline void StatsdClient::set(const Configuration& config,
+                              const detail::MetricView& metric,
+                              const T value,
+                              float frequency) const noexcept {
+    // Deduplicated members are all kept until the next flush, whatever the frequency unless it drops them all
+    if (config.sets) {
+        if (config.initialized() && !neverSampled(frequency)) {
+            std::size_t nameLength;
+            const auto& key = aggregationKey(config, metric, nameLength);
+            config.sets->add(key, nameLength, metric.typeLength, formatValue(config, value));
+        }
+        return;
+    }
+
+    send(config, metric, value, frequency);
+}
+
+inline void StatsdClient::sketch(const Configuration& config,
+                                 const detail::MetricView& metric,
+                                 const double value) const noexcept {
+    if (config.initialized()) {
+        std::size_t nameLength;
+        const auto& key = aggregationKey(config, metric, nameLength);
+        config.sketches->add(key, nameLength, metric.typeLength, value);
+    }
+}
+
+template <typename T>
+inline void StatsdClient::send(const Configuration& config,
+                               const detail::MetricView& metric,
                                const T value,
-                               const char* type,
-                               float frequency,
-                               const std::vector<std::string>& tags) const noexcept {
+                               float frequency) const noexcept {
     // Bail if we can't send anything anyway
-    if (!m_sender->initialized()) {
+    if (!config.initialized() || !sample(frequency)) {
         return;
     }
+    emit(config, metric, value, frequency);
+}
 
+inline bool StatsdClient::sample(float& frequency) const noexcept {
     // A valid frequency is: 0 <= f <= 1
     // At 0 you never emit the stat, at 1 you always emit the stat and with anything else you roll the dice
     frequency = std::max(std::min(frequency, 1.f), 0.f);
     constexpr float epsilon{0.0001f};
     const bool isFrequencyOne = std::fabs(frequency - 1.0f) < epsilon;
-    const bool isFrequencyZero = std::fabs(frequency) < epsilon;
-    if (isFrequencyZero ||
-        (!isFrequencyOne && (frequency < std::uniform_real_distribution<float>(0.f, 1.f)(m_randomEngine)))) {
-        return;
+    if (neverSampled(frequency)) {
+        return false;
+    }
+    if (isFrequencyOne) {
+        return true;
     }
+    const uint64_t stream = m_randomStream.load(std::memory_order_acquire);
+    auto& generator = detail::threadGenerator(stream, m_seed.load(std::memory_order_relaxed));
+    return detail::sampled(generator, frequency);
+}
 
-    // Format the stat message
-    std::stringstream valueStream;
-    valueStream << std::fixed << std::setprecision(m_gaugePrecision) << value;
+inline bool StatsdClient::neverSampled(const float frequency) noexcept {
+    constexpr float epsilon{0.0001f};
+    return frequency < epsilon;
+}
+
+template <typename T>
+inline void StatsdClient::emit(const Configuration& config,
+                               const detail::MetricView& metric,
+                               const T value,
+                               const float frequency) const noexcept {
+    // Packed values wait for the next flush, unless their line is complete already
+    if (config.values && ValuePacker::packs(StringView(metric.suffix.data() + 1, metric.typeLength - 1))) {
+        std::size_t nameLength;
+        const auto& key = aggregationKey(config, metric, nameLength, frequency);
+        auto& sender = config.sender();
+        static thread_local std::string line;
+        if (config.values->add(key,
+                               nameLength,
+                               formatValue(config, value),
+                               ValuePacker::maxLineLength(sender.maxMessageSize()),
+                               line)) {
+            sender.send(line);
+        }
+        return;
+    }
 
     // the thread keeps this buffer around and reuses it, clear should be O(1)
     // and reserve should only have to do so the first time, after that, it's a no-op
@@ -292,41 +1184,219 @@ inline void StatsdClient::send(const std::string& key,
     buffer.clear();
     buffer.reserve(256);
 
-    buffer.append(m_prefix);
-    if (!m_prefix.empty() && !key.empty()) {
-        buffer.push_back('.');
+    // Format the stat message
+    appendName(config, buffer, metric.key);
+    buffer.push_back(':');
+    detail::appendValue(buffer, value, config.gaugePrecision);
+    appendSuffix(config, buffer, metric, frequency);
+
+    // Send the message via the UDP sender of the shard
+    config.sender().send(buffer);
+}
+
+inline bool StatsdClient::keepsTiming(float& frequency, bool& sampled) const noexcept {
+    // Sketched timings are all kept, whatever the frequency unless it drops them all
+    const PinnedConfiguration config(m_config);
+    sampled = false;
+    if (!config->initialized()) {
+        return false;
+    }
+    if (config->sketches) {
+        return !neverSampled(frequency);
     }
+    sampled = true;
+    return sample(frequency);
+}
 
-    buffer.append(key);
-    buffer.push_back(':');
-    buffer.append(valueStream.str());
-    buffer.push_back('|');
-    buffer.append(type);
+inline void StatsdClient::recordTiming(const detail::MetricView& metric,
+                                       const double ms,
+                                       float frequency,
+                                       const bool sampled) const noexcept {
+    // The configuration may have changed since the timer started, in which case it follows the new one,
+    // sampling the timing now if it was started for sketches
+    const PinnedConfiguration config(m_config);
+    if (config->sketches) {
+        if (!neverSampled(frequency)) {
+            sketch(*config, metric, ms);
+        }
+        return;
+    }
+    if (config->initialized() && (sampled || sample(frequency))) {
+        emit(*config, metric, ms, frequency);
+    }
+}
 
+template <typename T>
+inline const std::string& StatsdClient::formatValue(const Configuration& config, const T value) noexcept {
+    // Like the send buffer, this one is reused by the thread
+    static thread_local std::string buffer;
+    buffer.clear();
+    detail::appendValue(buffer, value, config.gaugePrecision);
+    return buffer;
+}
+
+inline void StatsdClient::appendName(const Configuration& config, std::string& buffer, const StringView key) noexcept {
+    buffer.append(config.prefix);
+    if (!config.prefix.empty() && !key.empty()) {
+        buffer.push_back('.');
+    }
+    buffer.append(key.data(), key.size());
+}
+
+inline void StatsdClient::appendSuffix(const Configuration& config,
+                                       std::string& buffer,
+                                       const detail::MetricView& metric,
+                                       const float frequency) noexcept {
+    // The sample rate goes between the type and the tags
     if (frequency < 1.f) {
-        buffer.append("|@0.");
-        buffer.append(std::to_string(static_cast<int>(frequency * 100)));
+        buffer.append(metric.suffix.data(), metric.typeLength);
+        buffer.append("|@");
+        detail::appendRate(buffer, frequency);
+        buffer.append(metric.suffix.data() + metric.typeLength, metric.suffix.size() - metric.typeLength);
+    } else {
+        buffer.append(metric.suffix.data(), metric.suffix.size());
+    }
+
+    // The constant tags were joined once, they only need to be told apart from the tags of the metric, if any
+    if (!config.constantTags.empty()) {
+        buffer.append(metric.suffix.size() > metric.typeLength ? config.moreConstantTags : config.constantTags);
     }
+}
 
+inline void StatsdClient::serialize(detail::SerializedMetric& metric,
+                                    const StringView key,
+                                    const char* type,
+                                    const TagsView& tags) noexcept {
+    metric.key.assign(key.data(), key.size());
+    metric.suffix.assign(1, '|');
+    metric.suffix.append(type);
+    metric.typeLength = metric.suffix.size();
     if (!tags.empty()) {
-        buffer.append("|#");
-        for (const auto& tag : tags) {
-            buffer.append(tag);
-            buffer.push_back(',');
-        }
-        buffer.pop_back();
+        metric.suffix.append("|#");
+        tags.appendTo(metric.suffix);
     }
+}
 
-    // Send the message via the UDP sender
-    m_sender->send(buffer);
+inline const detail::SerializedMetric& StatsdClient::serialize(const StringView key,
+                                                               const char* type,
+                                                               const TagsView& tags) noexcept {
+    // Like the send buffer, this one is reused by the thread
+    static thread_local detail::SerializedMetric metric;
+    serialize(metric, key, type, tags);
+    return metric;
+}
+
+inline const std::string& StatsdClient::aggregationKey(const Configuration& config,
+                                                       const detail::MetricView& metric,
+                                                       std::size_t& nameLength,
+                                                       const float frequency) noexcept {
+    // Like the send buffer, this one is reused by the thread
+    static thread_local std::string buffer;
+    buffer.clear();
+    buffer.reserve(256);
+
+    appendName(config, buffer, metric.key);
+    nameLength = buffer.size();
+    appendSuffix(config, buffer, metric, frequency);
+    return buffer;
 }
 
 inline void StatsdClient::seed(unsigned int seed) noexcept {
-    m_randomEngine.seed(seed);
+    // The threads reseed their generators on their next draw, as the stream is new
+    m_seed.store(seed, std::memory_order_relaxed);
+    m_randomStream.store(detail::newRandomStream(), std::memory_order_release);
 }
 
 inline void StatsdClient::flush() noexcept {
-    m_sender->flush();
+    const PinnedConfiguration config(m_config);
+    config->flush();
+}
+
+inline Counter::Counter(const StatsdClient& client, detail::SerializedMetric metric) noexcept
+    : m_client(&client), m_metric(std::move(metric)) {}
+
+inline void Counter::increment(float frequency) const noexcept {
+    const StatsdClient::PinnedConfiguration config(m_client->m_config);
+    m_client->count(*config, m_metric.view(), 1, frequency);
+}
+
+inline void Counter::decrement(float frequency) const noexcept {
+    const StatsdClient::PinnedConfiguration config(m_client->m_config);
+    m_client->count(*config, m_metric.view(), -1, frequency);
+}
+
+inline void Counter::count(const int delta, float frequency) const noexcept {
+    const StatsdClient::PinnedConfiguration config(m_client->m_config);
+    m_client->count(*config, m_metric.view(), delta, frequency);
+}
+
+inline MetricHandle::MetricHandle(const StatsdClient& client,
+                                  detail::SerializedMetric metric,
+                                  const Kind kind) noexcept
+    : m_client(&client), m_metric(std::move(metric)), m_kind(kind) {}
+
+inline ScopedTimer::ScopedTimer(const StatsdClient& client, float frequency) noexcept
+    : m_client(&client),
+      m_metric(),
+      m_ownsMetric(false),
+      m_frequency(frequency),
+      m_sampled(false),
+      m_running(false),
+      m_start(0) {
+    m_running = client.keepsTiming(m_frequency, m_sampled);
+}
+
+inline ScopedTimer::ScopedTimer(ScopedTimer&& other) noexcept
+    : m_client(other.m_client),
+      m_ownMetric(std::move(other.m_ownMetric)),
+      m_metric(other.m_metric),
+      m_ownsMetric(other.m_ownsMetric),
+      m_frequency(other.m_frequency),
+      m_sampled(other.m_sampled),
+      m_running(other.m_running),
+      m_start(other.m_start) {
+    other.m_running = false;
+}
+
+inline ScopedTimer::~ScopedTimer() {
+    stop();
+}
+
+inline void ScopedTimer::start() noexcept {
+    m_start = detail::TickClock::now();
+}
+
+inline void ScopedTimer::stop() noexcept {
+    if (!m_running) {
+        return;
+    }
+    const uint64_t end = detail::TickClock::now();
+    m_running = false;
+    const double ms = detail::TickClock::milliseconds(end > m_start ? end - m_start : 0);
+    m_client->recordTiming(m_ownsMetric ? m_ownMetric.view() : m_metric, ms, m_frequency, m_sampled);
+}
+
+inline void ScopedTimer::cancel() noexcept {
+    m_running = false;
+}
+
+template <typename T>
+inline void MetricHandle::record(const T value, float frequency) const noexcept {
+    const StatsdClient::PinnedConfiguration config(m_client->m_config);
+    switch (m_kind) {
+        case Kind::Gauge:
+            m_client->gauge(*config, m_metric.view(), value, frequency);
+            break;
+        case Kind::Timing:
+            m_client->timing(*config, m_metric.view(), value, frequency);
+            break;
+        case Kind::Set:
+            m_client->set(*config, m_metric.view(), value, frequency);
+            break;
+        case Kind::Other:
+            m_client->send(*config, m_metric.view(), value, frequency);
+            break;
+    }
 }
 
 }  // namespace Statsd
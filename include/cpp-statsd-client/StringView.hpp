@@ -0,0 +1,77 @@
+#ifndef STRING_VIEW_HPP
+#define STRING_VIEW_HPP
+
+#include <cstring>
+#include <string>
+
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+
+namespace Statsd {
+
+/*!
+ *
+ * String view
+ *
+ * A non-owning reference to a sequence of characters, which is
+ * what the client takes for keys. It binds to std::string, string
+ * literals, a pointer and a length and, from C++17 on, std::string_view
+ * so that none of them needs a temporary std::string to be built.
+ *
+ */
+class StringView {
+public:
+    //!@name Constructors
+    //!@{
+
+    //! An empty string
+    constexpr StringView() noexcept : m_data(""), m_size(0) {}
+
+    //! A null terminated string
+    StringView(const char* data) noexcept : m_data(data ? data : ""), m_size(data ? std::strlen(data) : 0) {}
+
+    //! A pointer and a length
+    constexpr StringView(const char* data, const std::size_t size) noexcept : m_data(data), m_size(size) {}
+
+    //! A string
+    StringView(const std::string& string) noexcept : m_data(string.data()), m_size(string.size()) {}
+
+#if __cplusplus >= 201703L
+    //! A standard string view
+    constexpr StringView(const std::string_view view) noexcept : m_data(view.data()), m_size(view.size()) {}
+#endif
+
+    //!@}
+
+    //!@name Methods
+    //!@{
+
+    //! Returns the characters, not null terminated
+    constexpr const char* data() const noexcept {
+        return m_data;
+    }
+
+    //! Returns the number of characters
+    constexpr std::size_t size() const noexcept {
+        return m_size;
+    }
+
+    //! Returns true if there are no characters
+    constexpr bool empty() const noexcept {
+        return m_size == 0;
+    }
+
+    //!@}
+
+private:
+    //! The characters
+    const char* m_data;
+
+    //! The number of characters
+    std::size_t m_size;
+};
+
+}  // namespace Statsd
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef TAGS_VIEW_HPP
+#define TAGS_VIEW_HPP
+
+#include <cpp-statsd-client/StringView.hpp>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+namespace Statsd {
+
+/*!
+ *
+ * Tags view
+ *
+ * A non-owning reference to the tags of a metric, which is what the
+ * client takes for tags. It binds to a vector of strings, a braced
+ * list of strings or string literals, an array of string views, or
+ * tags already joined with commas. None of them needs a temporary
+ * vector or string to be built.
+ *
+ * As for any view, the tags must outlive it, which is always the case
+ * for the arguments of a call.
+ *
+ */
+class TagsView {
+public:
+    //!@name Constructors
+    //!@{
+
+    //! No tags
+    TagsView() noexcept : m_strings(nullptr), m_views(nullptr), m_count(0) {}
+
+    //! A vector of tags
+    TagsView(const std::vector<std::string>& tags) noexcept
+        : m_strings(tags.data()), m_views(nullptr), m_count(tags.size()) {}
+
+    //! A braced list of tags, whose array lives until the end of the call taking the view
+    TagsView(std::initializer_list<StringView> tags) noexcept : m_strings(nullptr), m_views(nullptr), m_count(0) {
+        m_views = tags.begin();
+        m_count = tags.size();
+    }
+
+    //! An array of tags
+    TagsView(const StringView* tags, const std::size_t count) noexcept
+        : m_strings(nullptr), m_views(tags), m_count(count) {}
+
+    //! Tags already joined with commas, e.g. "foo:1,bar:2"
+    static TagsView joined(const StringView tags) noexcept {
+        TagsView view;
+        view.m_joined = tags;
+        return view;
+    }
+
+    //!@}
+
+    //!@name Methods
+    //!@{
+
+    //! Returns true if there are no tags
+    bool empty() const noexcept {
+        return m_count == 0 && m_joined.empty();
+    }
+
+    //! Appends the tags, comma separated, to the buffer
+    void appendTo(std::string& buffer) const {
+        if (!m_joined.empty()) {
+            buffer.append(m_joined.data(), m_joined.size());
+            return;
+        }
+        for (std::size_t i = 0; i < m_count; ++i) {
+            if (i != 0) {
+                buffer.push_back(',');
+            }
+            if (m_strings != nullptr) {
+                buffer.append(m_strings[i]);
+            } else {
+                buffer.append(m_views[i].data(), m_views[i].size());
+            }
+        }
+    }
+
+    //!@}
+
+private:
+    //! The tags as strings, if so
+    const std::string* m_strings;
+
+    //! The tags as views, if so
+    const StringView* m_views;
+
+    //! The number of tags in either array
+    std::size_t m_count;
+
+    //! The tags already joined, if so
+    StringView m_joined;
+};
+
+}  // namespace Statsd
+
+#endif
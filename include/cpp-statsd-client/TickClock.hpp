@@ -0,0 +1,129 @@
+#ifndef TICK_CLOCK_HPP
+#define TICK_CLOCK_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <cpuid.h>
+#include <x86intrin.h>
+#define STATSD_HAS_TSC
+#endif
+
+namespace Statsd {
+namespace detail {
+
+/*!
+ *
+ * Tick clock
+ *
+ * The cheapest monotonic clock available, to time scopes. On x86 it
+ * reads the time stamp counter, provided the processor says it ticks
+ * at a constant rate whatever the power state (the invariant TSC) and,
+ * on Linux, that the kernel uses it as its own clock source, which it
+ * does not when the counters of the cores drift apart. The rate of the
+ * counter is calibrated once against the steady clock, over a couple
+ * of milliseconds, which the client does when it is constructed so
+ * that no timer waits for it.
+ *
+ * Anywhere else, the ticks are the nanoseconds of the steady clock.
+ *
+ */
+class TickClock {
+public:
+    //! Returns the current tick
+    static uint64_t now() noexcept {
+#ifdef STATSD_HAS_TSC
+        if (calibration().tsc) {
+            return __rdtsc();
+        }
+#endif
+        return static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+                .count());
+    }
+
+    //! Returns the number of milliseconds a number of ticks lasts
+    static double milliseconds(const uint64_t ticks) noexcept {
+        return static_cast<double>(ticks) * calibration().millisecondsPerTick;
+    }
+
+    //! Returns true if the ticks are those of the time stamp counter
+    static bool usesTsc() noexcept {
+        return calibration().tsc;
+    }
+
+    //! Calibrates the clock, unless it was already
+    static void calibrate() noexcept {
+        calibration();
+    }
+
+private:
+    //! How the ticks are read and converted
+    struct Calibration {
+        //! Whether the ticks are those of the time stamp counter
+        bool tsc;
+
+        //! The duration of a tick
+        double millisecondsPerTick;
+    };
+
+    //! Returns the calibration, made on first use
+    static const Calibration& calibration() noexcept {
+        static const Calibration calibration = measure();
+        return calibration;
+    }
+
+    //! Returns true if the time stamp counter is safe to time with
+    static bool tscIsSafe() noexcept {
+#ifdef STATSD_HAS_TSC
+        // The invariant TSC is advertised by bit 8 of EDX in the power management leaf
+        unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+        if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) == 0 || (edx & (1u << 8)) == 0) {
+            return false;
+        }
+#ifdef __linux__
+        std::ifstream source("/sys/devices/system/clocksource/clocksource0/current_clocksource");
+        std::string name;
+        return source >> name && name == "tsc";
+#else
+        return true;
+#endif
+#else
+        return false;
+#endif
+    }
+
+    //! Measure the rate of the ticks
+    static Calibration measure() noexcept {
+        Calibration calibration{false, 1e-6};
+#ifdef STATSD_HAS_TSC
+        if (!tscIsSafe()) {
+            return calibration;
+        }
+
+        // Count the ticks over a couple of milliseconds of the steady clock
+        using Clock = std::chrono::steady_clock;
+        const auto start = Clock::now();
+        const uint64_t first = __rdtsc();
+        auto end = start;
+        while (end - start < std::chrono::milliseconds(2)) {
+            end = Clock::now();
+        }
+        const uint64_t last = __rdtsc();
+        if (last > first) {
+            calibration.tsc = true;
+            calibration.millisecondsPerTick =
+                std::chrono::duration<double, std::milli>(end - start).count() / static_cast<double>(last - first);
+        }
+#endif
+        return calibration;
+    }
+};
+
+}  // namespace detail
+}  // namespace Statsd
+
+#endif
@@ -8,8 +8,13 @@
 #include <ws2tcpip.h>
 #else
 #include <arpa/inet.h>
+#include <fcntl.h>
 #include <netdb.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <unistd.h>
 #endif
 
@@ -17,14 +22,25 @@
 #include <netinet/in.h>
 #endif
 
+#include <algorithm>
 #include <atomic>
+#include <cerrno>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
+#include <cpp-statsd-client/IoUring.hpp>
+#include <cpp-statsd-client/LocalBatch.hpp>
+#include <cpp-statsd-client/RingBuffer.hpp>
+#include <cpp-statsd-client/Stats.hpp>
 #include <cstdint>
 #include <cstring>
-#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <thread>
+#include <vector>
 
 namespace Statsd {
 
@@ -40,15 +56,141 @@ constexpr SOCKET_TYPE k_invalidSocket{-1};
 #define SOCKET_CLOSE close
 #endif
 
+// sendmmsg is a Linux extension exposed by the GNU headers
+#if defined(__linux__) && defined(_GNU_SOURCE)
+#define STATSD_HAS_SENDMMSG
+#endif
+
+//! The prefix of a host naming the path of a Unix domain socket, e.g. "unix:///var/run/statsd.sock"
+constexpr const char* k_unixScheme{"unix://"};
+
+//! The prefix of a host reached over a persistent TCP connection, e.g. "tcp://statsd.example.com"
+constexpr const char* k_tcpScheme{"tcp://"};
+
+//! The largest payload of a UDP datagram over IPv4
+constexpr std::size_t k_maxUdpPayload{65507};
+
+//! What to do with a message when the queue is full
+enum class OverloadPolicy {
+    //! Drop the message
+    DropNewest,
+
+    //! Drop the oldest queued messages until the message fits
+    DropOldest,
+
+    //! Wait for the batching thread to drain the queue, up to the block timeout, then drop the message
+    //! Without a batching thread, or from it, the message is dropped right away
+    Block
+};
+
+/*!
+ *
+ * Sender options
+ *
+ * The tuning knobs of the sender, the defaults suit most uses.
+ *
+ */
+struct SenderOptions {
+    //! The capacity in bytes of the queue of messages waiting to be batched, which bounds its memory
+    std::size_t queueCapacity = 4 * 1024 * 1024;
+
+    //! What to do with a message when the queue is full
+    OverloadPolicy overloadPolicy = OverloadPolicy::DropNewest;
+
+    //! The time in milliseconds a message waits at most for room in the queue, with the block policy
+    uint64_t blockTimeout = 10;
+
+    //! The maximum number of batches handed to the kernel at once, where sendmmsg is available
+    std::size_t batchesPerSyscall = 64;
+
+    //! The number of queued bytes waking the batching thread up before the send interval elapses
+    std::size_t highWaterMark = 64 * 1024;
+
+    //! The time in milliseconds the destructor spends at most sending what is still queued, 0 to drop it
+    uint64_t drainTimeout = 1000;
+
+    //! The time in milliseconds a connection attempt or a write to a TCP daemon waits at most
+    uint64_t tcpTimeout = 1000;
+
+    //! The time in milliseconds before reconnecting to a TCP daemon, doubled after every failed attempt
+    uint64_t reconnectBackoff = 100;
+
+    //! The longest time in milliseconds between two attempts to reconnect to a TCP daemon
+    uint64_t maxReconnectBackoff = 10000;
+
+    //! The largest UDP datagram sent, 0 to derive it from the MTU of the route to the daemon where possible
+    //! A batch never grows beyond it, and a message which does not fit on its own is dropped
+    std::size_t maxDatagramSize = 0;
+
+    //! Whether batches are sent to a UDP daemon through io_uring, where Linux permits it, rather than by syscalls
+    bool ioUring = false;
+
+    //! Whether each producer thread packs its messages into a batch of its own, queued once full, rather than
+    //! queuing every message
+    bool threadLocalBatches = false;
+};
+
 /*!
  *
  * UDP sender
  *
  * A simple UDP sender handling batching.
  *
+ * Over UDP, no datagram is larger than the maximum datagram size,
+ * derived by default from the MTU of the route to the daemon so that
+ * datagrams are not fragmented. A message which does not fit in one
+ * is dropped, counted as oversized and reported.
+ *
+ * When batching, messages are queued in a bounded lock-free ring
+ * so that producers never contend on a lock. They are packed into
+ * batches by whoever drains the ring: the batching thread or the
+ * flush method. When the ring is full, the overload policy decides
+ * whether the new message or the oldest ones are dropped, or whether
+ * the producer waits for room. Dropped messages are counted.
+ *
+ * The batching thread drains the ring every send interval, or as soon
+ * as the queued messages reach the high-water mark. On destruction,
+ * whatever is still queued is sent within the drain timeout.
+ *
+ * Optionally, each producer thread packs its messages into a batch of
+ * its own first, see detail::LocalBatch, and only queues that batch
+ * once the next message would not fit in it. Whoever drains the ring
+ * collects the partial batches beforehand, so that a thread which
+ * stops sending does not hold its messages back beyond the interval.
+ * The messages are then counted in the stats once queued.
+ *
+ * On Linux the batches are sent several at a time with sendmmsg,
+ * otherwise they are sent one by one. Optionally, they are submitted
+ * to an io_uring instead, see detail::IoUringSender, without waiting
+ * for them to go out. That falls back to sendmmsg wherever io_uring is
+ * unavailable.
+ *
+ * A host of the form "unix:///path/to/socket" sends to a local daemon
+ * over a Unix domain datagram socket rather than UDP, the port being
+ * ignored. That socket is non-blocking: when the buffer of the daemon
+ * is full, the datagram fails with EAGAIN instead of stalling, and is
+ * counted and reported like any other failure.
+ *
+ * A host of the form "tcp://hostname" keeps a TCP connection to the
+ * daemon instead, and writes whole batches to it, newline terminated,
+ * with one vectored write per drain. When the connection fails, the
+ * batches which were not written are kept and written again once
+ * reconnected, and the queue is left alone in the meantime, which
+ * bounds the buffering to its capacity. Of a batch written in part,
+ * the lines written completely are not written again, and the line
+ * torn by the failure is dropped. Reconnecting is attempted again and
+ * again, waiting twice as long after each failure. A daemon which
+ * closed the connection is noticed when writing to it fails. Without
+ * batching, the messages are queued all the same and written one per
+ * line by the batching thread, which every message wakes up, so that
+ * the callers never wait on the connection.
+ *
  */
 class UDPSender final {
 public:
+    //! Callback giving a chance to send more messages right before the queue is flushed
+    using FlushCallback = std::function<void(UDPSender&)>;
+
     //!@name Constructor and destructor, non-copyable
     //!@{
 
@@ -56,7 +198,9 @@ public:
     UDPSender(const std::string& host,
               const uint16_t port,
               const uint64_t batchsize,
-              const uint64_t sendInterval) noexcept;
+              const uint64_t sendInterval,
+              const SenderOptions& options = SenderOptions(),
+              FlushCallback flushCallback = nullptr) noexcept;
 
     //! Destructor
     ~UDPSender();
@@ -73,30 +217,121 @@ public:
     //! Send or enqueue a message
     void send(const std::string& message) noexcept;
 
-    //! Returns the error message as a string
-    const std::string& errorMessage() const noexcept;
+    //! Returns a copy of the error message, as the threads sending may replace it meanwhile
+    std::string errorMessage() const noexcept;
 
     //! Returns true if the sender is initialized
     bool initialized() const noexcept;
 
+    //! Returns the number of messages dropped because the queue was full or the drain timed out
+    uint64_t droppedMessages() const noexcept;
+
+    //! Returns the number of bytes of the dropped messages
+    uint64_t droppedBytes() const noexcept;
+
+    //! Returns a snapshot of the counters of the sender
+    Stats stats() const noexcept;
+
+    //! Returns true if the batches are sent through io_uring
+    bool usesIoUring() const noexcept;
+
+    //! Returns the size a message should not exceed to fit in a batch, or in a datagram without batching
+    std::size_t maxMessageSize() const noexcept;
+
     //! Flushes any queued messages
     void flush() noexcept;
 
     //!@}
 
 private:
+    //! The clock of the deadlines
+    using Clock = std::chrono::steady_clock;
+
     // @name Private methods
     // @{
 
     //! Initialize the sender and returns true when it is initialized
     bool initialize() noexcept;
 
-    //! Queue a message to be sent to the daemon later
-    inline void queueMessage(const std::string& message) noexcept;
+    //! Resolve the address of a UDP or TCP daemon into the server structure, returns true on success
+    bool resolveInet(const std::string& host) noexcept;
+
+    //! Returns the largest payload which is not fragmented on the route to the UDP daemon, as far as we know
+    std::size_t pathDatagramSize() const noexcept;
+
+    //! Open a socket to the Unix domain socket at the path, returns true on success
+    bool initializeUnix(const std::string& path) noexcept;
+
+    //! Returns where the datagrams go, for the error messages
+    std::string destination() const;
+
+    //! Replace the error message
+    void setErrorMessage(std::string message) noexcept;
+
+    //! Describe a failure to send to the daemon
+    void reportSendFailure(const char* call, const int error, const std::string& details) noexcept;
+
+    //! Connect to the TCP daemon unless connected already or waiting to retry, returns true when connected
+    bool connectToDaemon(const bool now = false) noexcept;
+
+    //! Close the connection to the TCP daemon after a failure, and wait before reconnecting
+    void disconnect(const char* call, const int error) noexcept;
+
+    //! Write the batches left over by a failed connection, returns true when there are none left
+    bool sendUnsent(const bool now = false) noexcept;
+
+    //! Write batches to the TCP daemon, keeping those which were not written completely for later
+    void sendToStream(const std::string* batches, const std::size_t count) noexcept;
+
+    //! Write batches to the TCP daemon, newline terminated, and returns how many were written completely
+    //! The number of bytes written of the next one, if any, is left in m_partialBytes
+    std::size_t writeToStream(const std::string* batches, const std::size_t count) noexcept;
+
+    //! Remove from a batch written in part the lines which were written and the one which was torn
+    void skipWritten(std::string& batch, const std::size_t written) noexcept;
+
+    //! Drop whatever is still queued or left over by a failed connection
+    void dropQueued() noexcept;
+
+    //! Queue one or several newline separated messages to be sent to the daemon later
+    inline void queueMessage(const char* data, const std::size_t size, const uint64_t messages) noexcept;
+
+    //! Append a message to the batch of the calling thread, queuing the batch first if the message does not fit
+    inline void appendToLocalBatch(const std::string& message) noexcept;
+
+    //! Queue the messages of a local batch, which must be held, and empty it
+    void queueLocalBatch(detail::LocalBatch& batch) noexcept;
+
+    //! Queue the partial batches of the threads, waiting for those in use unless they are skipped
+    void collectLocalBatches(const bool skipBusy) noexcept;
+
+    //! Pack the queued messages into batches and send them until the deadline, the batching mutex must be held
+    void drainQueue(const Clock::time_point deadline = Clock::time_point::max()) noexcept;
+
+    //! Wake the batching thread up
+    void wakeUp() noexcept;
+
+    //! Count dropped messages
+    void countDrop(const uint64_t messages, const uint64_t bytes) noexcept;
+
+    //! Count the messages of batches which are dropped
+    void countDroppedBatches(const std::size_t batches) noexcept;
+
+    //! Returns the number of newline separated messages
+    static uint64_t countMessages(const char* data, const std::size_t size) noexcept;
+
+    //! Count a datagram which failed to be sent
+    void countSendFailure(const int error) noexcept;
+
+    //! Count a datagram sent asynchronously, given the number of bytes sent or minus the errno
+    void countCompletion(const int result) noexcept;
 
     //! Send a message to the daemon
     void sendToDaemon(const std::string& message) noexcept;
 
+    //! Send several messages to the daemon, with as few syscalls as possible
+    void sendToDaemon(const std::string* messages, const std::size_t count) noexcept;
+
     //!@}
 
 private:
@@ -106,6 +341,9 @@ private:
     //! Shall we exit?
     std::atomic<bool> m_mustExit{false};
 
+    //! Has the batching thread been woken up since it last drained the queue?
+    std::atomic<bool> m_wokenUp{false};
+
     //!@}
 
     // @name Network info
@@ -117,12 +355,55 @@ private:
     //! The port
     uint16_t m_port;
 
-    //! The structure holding the server
-    struct sockaddr_in m_server;
+    //! The structure holding the server, an IPv4 or a Unix domain address
+    struct sockaddr_storage m_server;
+
+    //! The length of the address in the server structure
+    socklen_t m_serverLength = 0;
 
     //! The socket to be used
     SOCKET_TYPE m_socket = k_invalidSocket;
 
+    //! How the daemon is reached
+    enum class Transport { Udp, Unix, Tcp };
+    Transport m_transport = Transport::Udp;
+
+    //! Whether the sender is initialized, a TCP one staying so while disconnected
+    bool m_initialized = false;
+
+    //!@}
+
+    // @name TCP connection, guarded by the batching mutex
+    // @{
+
+    //! The time in milliseconds a connection attempt or a write waits at most
+    uint64_t m_tcpTimeout;
+
+    //! The time in milliseconds before the first attempt to reconnect, and between later ones at most
+    uint64_t m_reconnectBackoff;
+    uint64_t m_maxReconnectBackoff;
+
+    //! The time in milliseconds to wait after the next failed attempt
+    uint64_t m_backoff = 0;
+
+    //! When to attempt reconnecting next
+    Clock::time_point m_nextConnect;
+
+    //! The batches which were not written completely before the connection failed
+    std::vector<std::string> m_unsent;
+
+    //! The number of bytes of those batches, bounded by the capacity of the queue
+    std::size_t m_unsentBytes = 0;
+    std::size_t m_unsentCapacity;
+
+    //! The number of bytes written of the batch the last write failed on
+    std::size_t m_partialBytes = 0;
+
+#ifndef _WIN32
+    //! The buffers of a vectored write, a batch and its newline each
+    std::vector<struct iovec> m_streamBuffers;
+#endif
+
     //!@}
 
     // @name Batching info
@@ -131,22 +412,131 @@ private:
     //! The batching size
     uint64_t m_batchsize;
 
+    //! The largest datagram sent, the size of a message dropped as oversized
+    std::size_t m_maxDatagramSize;
+
+    //! The size a batch never grows beyond, the smallest of the batching and datagram sizes
+    std::size_t m_batchLimit;
+
     //! The sending frequency in milliseconds
     uint64_t m_sendInterval;
 
-    //! The queue batching the messages
-    std::deque<std::string> m_batchingMessageQueue;
+    //! The queue of messages waiting to be batched
+    std::unique_ptr<RingBuffer> m_messageQueue;
 
-    //! The mutex used for batching
+    //! The number of queued bytes waking the batching thread up
+    std::size_t m_highWaterMark;
+
+    //! The time in milliseconds spent at most draining the queue on destruction
+    uint64_t m_drainTimeout;
+
+    //! The mutex serializing the draining of the queue
     std::mutex m_batchingMutex;
 
+    //! The mutex and condition the batching thread waits on between drains
+    std::mutex m_wakeUpMutex;
+    std::condition_variable m_wakeUp;
+
+    //! What to do with a message when the queue is full
+    OverloadPolicy m_overloadPolicy;
+
+    //! The time in milliseconds a message waits at most for room in the queue
+    uint64_t m_blockTimeout;
+
+    //! The mutex and condition the blocked producers wait on until the queue is drained
+    std::mutex m_drainedMutex;
+    std::condition_variable m_drained;
+
+    //! The number of producers waiting for room in the queue
+    std::atomic<uint32_t> m_blockedProducers{0};
+
+    //! The number of dropped messages
+    std::atomic<uint64_t> m_droppedMessages{0};
+
+    //! The number of bytes of the dropped messages
+    std::atomic<uint64_t> m_droppedBytes{0};
+
+    //! The number of messages dropped because they do not fit in a datagram
+    std::atomic<uint64_t> m_oversizedMessages{0};
+
+    //!@}
+
+    // @name Local batches, when enabled
+    // @{
+
+    //! The identifier of the sender in the slots of the threads, 0 unless the threads batch locally
+    uint64_t m_batchOwner = 0;
+
+    //! The batches of the threads, which they leave to the sender once this is the only reference
+    std::vector<std::shared_ptr<detail::LocalBatch>> m_localBatches;
+
+    //! The mutex guarding the list of local batches
+    std::mutex m_localBatchesMutex;
+
+    //!@}
+
+    // @name Counters, see Stats
+    // @{
+
+    //! The number of errno values counted apart, the last slot counting any larger one
+    static constexpr int k_errnoSlots{256};
+
+    //! The number of messages handed to the sender
+    detail::StripedCounter m_messages;
+
+    //! The number of bytes queued
+    detail::StripedCounter m_bytesQueued;
+
+    //! The number of datagrams sent
+    std::atomic<uint64_t> m_datagramsSent{0};
+
+    //! The number of failed datagrams by errno
+    std::atomic<uint64_t> m_sendFailures[k_errnoSlots]{};
+
+    //! The largest number of bytes queued at once
+    std::atomic<uint64_t> m_queueHighWaterMark{0};
+
+    //! The number of queue flushes by duration
+    std::atomic<uint64_t> m_flushDurations[Stats::k_flushBuckets]{};
+
+    //! The batches packed while draining the queue, reused from one drain to the next
+    std::vector<std::string> m_batches;
+
+    //! The maximum number of batches sent at once
+    std::size_t m_batchesPerSyscall;
+
+#ifdef STATSD_HAS_SENDMMSG
+    //! The headers handed to sendmmsg
+    std::vector<struct mmsghdr> m_messageHeaders;
+
+    //! The buffers referenced by the headers
+    std::vector<struct iovec> m_messageBuffers;
+
+    //! Whether sendmmsg turned out to be unsupported by the kernel
+    bool m_sendmmsgUnavailable = false;
+#endif
+
+#ifdef STATSD_HAS_IO_URING
+    //! The io_uring the batches are submitted to, if any
+    std::unique_ptr<detail::IoUringSender> m_ioUring;
+#endif
+
     //! The thread dedicated to the batching
     std::thread m_batchingThread;
 
+    //! The callback invoked before flushing the queue
+    FlushCallback m_flushCallback;
+
     //!@}
 
-    //! Error message (optional string)
+    //! Error message (optional string), written by the producers and the batching thread alike
     std::string m_errorMessage;
+
+    //! The mutex guarding the error message
+    mutable std::mutex m_errorMutex;
+
+    //! Whether there is an error message, so that sending does not lock to clear an empty one
+    std::atomic<bool> m_hasError{false};
 };
 
 namespace detail {
@@ -182,33 +572,97 @@ private:
 inline UDPSender::UDPSender(const std::string& host,
                             const uint16_t port,
                             const uint64_t batchsize,
-                            const uint64_t sendInterval) noexcept
-    : m_host(host), m_port(port), m_batchsize(batchsize), m_sendInterval(sendInterval) {
-    // Initialize the socket
-    if (m_host.empty() || !initialize()) {
+                            const uint64_t sendInterval,
+                            const SenderOptions& options,
+                            FlushCallback flushCallback) noexcept
+    : m_host(host),
+      m_port(port),
+      m_tcpTimeout(std::max<uint64_t>(options.tcpTimeout, 1)),
+      m_reconnectBackoff(std::max<uint64_t>(options.reconnectBackoff, 1)),
+      m_maxReconnectBackoff(std::max(options.maxReconnectBackoff, m_reconnectBackoff)),
+      m_unsentCapacity(options.queueCapacity),
+      m_batchsize(batchsize),
+      m_maxDatagramSize(options.maxDatagramSize),
+      m_batchLimit(0),
+      m_sendInterval(sendInterval),
+      m_highWaterMark(options.highWaterMark),
+      m_drainTimeout(options.drainTimeout),
+      m_overloadPolicy(options.overloadPolicy),
+      m_blockTimeout(options.blockTimeout),
+      m_batchesPerSyscall(std::max<std::size_t>(options.batchesPerSyscall, 1)),
+      m_flushCallback(std::move(flushCallback)) {
+    // If batching is on, allocate the queue and the batches up front
+    if (m_batchsize != 0) {
+        m_messageQueue.reset(new RingBuffer(options.queueCapacity));
+        m_highWaterMark = std::min(m_highWaterMark, m_messageQueue->capacity());
+        m_batches.resize(m_batchesPerSyscall);
+        for (auto& batch : m_batches) {
+            batch.reserve(m_batchsize + 256);
+        }
+        if (options.threadLocalBatches) {
+            m_batchOwner = detail::newBatchOwner();
+        }
+#ifdef STATSD_HAS_SENDMMSG
+        m_messageHeaders.resize(m_batchesPerSyscall);
+        m_messageBuffers.resize(m_batchesPerSyscall);
+#endif
+    }
+
+    // Initialize the socket, only UDP datagrams are limited as the other transports do not fragment
+    const bool initialized = !m_host.empty() && initialize();
+    if (!initialized || m_transport != Transport::Udp) {
+        m_maxDatagramSize = std::numeric_limits<std::size_t>::max();
+    } else if (m_maxDatagramSize == 0) {
+        m_maxDatagramSize = pathDatagramSize();
+    }
+    m_batchLimit = static_cast<std::size_t>(std::min<uint64_t>(m_batchsize, m_maxDatagramSize));
+    if (!initialized) {
         return;
     }
 
-    // If batching is on, use a dedicated thread to send after the wait time is reached
-    if (m_batchsize != 0 && m_sendInterval > 0) {
-        // Define the batching thread
-        m_batchingThread = std::thread([this] {
-            // TODO: this will drop unsent stats, should we send all the unsent stats before we exit?
+    // Without batching, a TCP daemon is written to by the batching thread all the same, one message per batch
+    const bool streamsAlone = m_transport == Transport::Tcp && m_batchsize == 0;
+    if (streamsAlone) {
+        m_messageQueue.reset(new RingBuffer(options.queueCapacity));
+        m_highWaterMark = 1;
+        m_batches.resize(m_batchesPerSyscall);
+    }
+
+#ifdef STATSD_HAS_IO_URING
+    // Batches up to the batch limit go through io_uring, two drains' worth in flight, the few larger ones do not
+    if (options.ioUring && m_messageQueue && m_transport == Transport::Udp) {
+        m_ioUring.reset(new detail::IoUringSender(2 * m_batchesPerSyscall, m_batchLimit));
+        if (!m_ioUring->available()) {
+            m_ioUring.reset();
+        }
+    }
+#endif
+
+    // If batching is on, use a dedicated thread to send after the wait time is reached or the queue fills up
+    if ((m_batchsize != 0 && m_sendInterval > 0) || streamsAlone) {
+        // Without a send interval, the thread wakes up to retry the batches left over by a failed connection
+        const uint64_t interval = m_sendInterval > 0 ? m_sendInterval : m_reconnectBackoff;
+
+        // Define the batching thread, the destructor drains what is left after it exits
+        m_batchingThread = std::thread([this, interval] {
             while (!m_mustExit.load(std::memory_order_acquire)) {
-                std::deque<std::string> stagedMessageQueue;
+                // Let the owner queue anything it held back until now, and the threads their partial batches
+                if (m_flushCallback) {
+                    m_flushCallback(*this);
+                }
+                collectLocalBatches(true);
 
+                // Flush the queue, the producers may wake us up again from now on
+                m_wokenUp.store(false, std::memory_order_release);
                 std::unique_lock<std::mutex> batchingLock(m_batchingMutex);
-                m_batchingMessageQueue.swap(stagedMessageQueue);
+                drainQueue();
                 batchingLock.unlock();
 
-                // Flush the queue
-                while (!stagedMessageQueue.empty()) {
-                    sendToDaemon(stagedMessageQueue.front());
-                    stagedMessageQueue.pop_front();
-                }
-
-                // Wait before sending the next batch
-                std::this_thread::sleep_for(std::chrono::milliseconds(m_sendInterval));
+                // Wait before sending the next batch, unless the queue reaches the high-water mark
+                std::unique_lock<std::mutex> wakeUpLock(m_wakeUpMutex);
+                m_wakeUp.wait_for(wakeUpLock, std::chrono::milliseconds(interval), [this] {
+                    return m_wokenUp.load(std::memory_order_acquire) || m_mustExit.load(std::memory_order_acquire);
+                });
             }
         });
     }
@@ -222,19 +676,72 @@ inline UDPSender::~UDPSender() {
     // If we're running a background thread tell it to stop
     if (m_batchingThread.joinable()) {
         m_mustExit.store(true, std::memory_order_release);
+        wakeUp();
         m_batchingThread.join();
     }
 
+    // Queue what the owner and the threads held back, outside the batching lock which queuing may take
+    const auto deadline = Clock::now() + std::chrono::milliseconds(m_drainTimeout);
+    if (m_messageQueue && m_drainTimeout != 0) {
+        if (m_flushCallback) {
+            m_flushCallback(*this);
+        }
+        collectLocalBatches(false);
+    }
+
+    // Send what is still queued, as long as the deadline allows
+    std::lock_guard<std::mutex> batchingLock(m_batchingMutex);
+    if (m_transport == Transport::Tcp && m_drainTimeout != 0 && !m_unsent.empty()) {
+        sendUnsent(true);
+    }
+    if (m_messageQueue && m_drainTimeout != 0) {
+        drainQueue(deadline);
+    }
+
+    // A TCP daemon which could not be reached does not get the rest
+    if (m_transport == Transport::Tcp) {
+        dropQueued();
+    }
+
+#ifdef STATSD_HAS_IO_URING
+    // Let the datagrams in flight go out
+    if (m_ioUring) {
+        m_ioUring->wait([this](const int result) { countCompletion(result); });
+        m_ioUring.reset();
+    }
+#endif
+
     // Cleanup the socket
-    SOCKET_CLOSE(m_socket);
+    if (detail::isValidSocket(m_socket)) {
+        SOCKET_CLOSE(m_socket);
+    }
 }
 
 inline void UDPSender::send(const std::string& message) noexcept {
-    m_errorMessage.clear();
+    if (m_hasError.load(std::memory_order_relaxed)) {
+        setErrorMessage(std::string());
+    }
+
+    // A message which does not fit in a datagram would be fragmented or refused, drop it right away
+    if (message.size() > m_maxDatagramSize) {
+        m_messages.add(1);
+        m_oversizedMessages.fetch_add(1, std::memory_order_relaxed);
+        countDrop(1, message.size());
+        setErrorMessage("message too large for a datagram: size=" + std::to_string(message.size()) +
+                        ", max=" + std::to_string(m_maxDatagramSize));
+        return;
+    }
 
-    // If batching is on, accumulate messages in the queue
-    if (m_batchsize > 0) {
-        queueMessage(message);
+    // The threads batching locally count their messages once they queue them
+    if (m_batchOwner != 0) {
+        appendToLocalBatch(message);
+        return;
+    }
+    m_messages.add(1);
+
+    // If batching is on, or the daemon is reached over TCP, accumulate messages in the queue
+    if (m_messageQueue) {
+        queueMessage(message.data(), message.size(), 1);
         return;
     }
 
@@ -242,73 +749,588 @@ inline void UDPSender::send(const std::string& message) noexcept {
     sendToDaemon(message);
 }
 
-inline void UDPSender::queueMessage(const std::string& message) noexcept {
-    // We aquire a lock but only if we actually need to (i.e. there is a thread also accessing the queue)
-    auto batchingLock =
-        m_batchingThread.joinable() ? std::unique_lock<std::mutex>(m_batchingMutex) : std::unique_lock<std::mutex>();
-    // Either we don't have a place to batch our message or we exceeded the batch size, so make a new batch
-    if (m_batchingMessageQueue.empty() || m_batchingMessageQueue.back().length() > m_batchsize) {
-        m_batchingMessageQueue.emplace_back();
-        m_batchingMessageQueue.back().reserve(m_batchsize + 256);
-    }  // When there is already a batch open we need a separator when its not empty
-    else if (!m_batchingMessageQueue.back().empty()) {
-        m_batchingMessageQueue.back().push_back('\n');
+inline void UDPSender::queueMessage(const char* data, const std::size_t size, const uint64_t messages) noexcept {
+    // No lock is needed, the batches are packed when draining the queue
+    // A full queue means the daemon cannot keep up, the overload policy decides what to drop
+    bool queued = m_messageQueue->push(data, size);
+    if (!queued && size <= m_messageQueue->capacity()) {
+        if (m_overloadPolicy == OverloadPolicy::DropOldest) {
+            // Discard the oldest messages under the consumer lock until the new one fits
+            std::lock_guard<std::mutex> batchingLock(m_batchingMutex);
+            while (!queued) {
+                const auto discarded = m_messageQueue->consume(
+                    [this](const char* oldest, const std::size_t length) {
+                        countDrop(countMessages(oldest, length), length);
+                    },
+                    1);
+                if (discarded == 0) {
+                    // Only uncommitted messages are left, which cannot be discarded
+                    break;
+                }
+                queued = m_messageQueue->push(data, size);
+            }
+        } else if (m_overloadPolicy == OverloadPolicy::Block && m_batchingThread.joinable() &&
+                   std::this_thread::get_id() != m_batchingThread.get_id()) {
+            // Wait for the batching thread to drain the queue, in short slices as it may not notify us in time
+            const auto deadline = Clock::now() + std::chrono::milliseconds(m_blockTimeout);
+            m_blockedProducers.fetch_add(1, std::memory_order_acq_rel);
+            while (!queued && Clock::now() < deadline) {
+                wakeUp();
+                std::unique_lock<std::mutex> drainedLock(m_drainedMutex);
+                m_drained.wait_until(drainedLock, std::min(deadline, Clock::now() + std::chrono::milliseconds(1)));
+                drainedLock.unlock();
+                queued = m_messageQueue->push(data, size);
+            }
+            m_blockedProducers.fetch_sub(1, std::memory_order_acq_rel);
+        }
+    }
+    if (!queued) {
+        countDrop(messages, size);
+        return;
+    }
+    m_bytesQueued.add(size);
+    const std::size_t queuedBytes = m_messageQueue->size();
+    detail::raiseMaximum(m_queueHighWaterMark, queuedBytes);
+
+    // Past the high-water mark, wake the batching thread up once until it drains the queue
+    if (m_batchingThread.joinable() && queuedBytes >= m_highWaterMark && !m_wokenUp.load(std::memory_order_relaxed) &&
+        !m_wokenUp.exchange(true, std::memory_order_acq_rel)) {
+        wakeUp();
+    }
+}
+
+inline void UDPSender::appendToLocalBatch(const std::string& message) noexcept {
+    // The first message of the thread registers its batch, which the sender collects from then on
+    auto& slot = detail::threadBatch(m_batchOwner);
+    if (!slot) {
+        slot = std::make_shared<detail::LocalBatch>();
+        slot->lines.reserve(std::min<std::size_t>(m_batchLimit, k_maxUdpPayload));
+        std::lock_guard<std::mutex> localBatchesLock(m_localBatchesMutex);
+        m_localBatches.push_back(slot);
+    }
+
+    // Only the sender collecting the batch may be using it, the other threads have batches of their own
+    auto& batch = *slot;
+    batch.lock();
+    if (!batch.lines.empty() && batch.lines.size() + 1 + message.size() > m_batchLimit) {
+        queueLocalBatch(batch);
+    }
+    if (!batch.lines.empty()) {
+        batch.lines.push_back('\n');
+    }
+    batch.lines.append(message);
+    ++batch.messages;
+    batch.unlock();
+}
+
+inline void UDPSender::queueLocalBatch(detail::LocalBatch& batch) noexcept {
+    m_messages.add(batch.messages);
+    queueMessage(batch.lines.data(), batch.lines.size(), batch.messages);
+    batch.lines.clear();
+    batch.messages = 0;
+}
+
+inline void UDPSender::collectLocalBatches(const bool skipBusy) noexcept {
+    if (m_batchOwner == 0) {
+        return;
+    }
+
+    // A batch in use is being appended to, and is collected next time unless we must wait for it
+    std::lock_guard<std::mutex> localBatchesLock(m_localBatchesMutex);
+    for (auto& batch : m_localBatches) {
+        if (!skipBusy) {
+            batch->lock();
+        } else if (!batch->tryLock()) {
+            continue;
+        }
+        if (batch->messages != 0) {
+            queueLocalBatch(*batch);
+        }
+        batch->unlock();
+    }
+
+    // The batches of the threads which exited or evicted them are reclaimed, no thread can get them back
+    m_localBatches.erase(std::remove_if(m_localBatches.begin(),
+                                        m_localBatches.end(),
+                                        [](const std::shared_ptr<detail::LocalBatch>& batch) {
+                                            return batch.use_count() == 1 && batch->messages == 0;
+                                        }),
+                         m_localBatches.end());
+}
+
+inline void UDPSender::countDrop(const uint64_t messages, const uint64_t bytes) noexcept {
+    m_droppedMessages.fetch_add(messages, std::memory_order_relaxed);
+    m_droppedBytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+inline void UDPSender::countDroppedBatches(const std::size_t batches) noexcept {
+    for (std::size_t i = 0; i < batches; ++i) {
+        countDrop(countMessages(m_batches[i].data(), m_batches[i].size()), m_batches[i].size());
     }
-    // Add the new message to the batch
-    m_batchingMessageQueue.back().append(message);
 }
 
-inline const std::string& UDPSender::errorMessage() const noexcept {
+inline uint64_t UDPSender::countMessages(const char* data, const std::size_t size) noexcept {
+    return static_cast<uint64_t>(std::count(data, data + size, '\n')) + 1;
+}
+
+inline void UDPSender::countSendFailure(const int error) noexcept {
+    const int slot = std::max(0, std::min(error, k_errnoSlots - 1));
+    m_sendFailures[slot].fetch_add(1, std::memory_order_relaxed);
+}
+
+inline void UDPSender::countCompletion(const int result) noexcept {
+    if (result >= 0) {
+        m_datagramsSent.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    countSendFailure(-result);
+    reportSendFailure("io_uring send", -result, ", err=" + std::to_string(-result));
+}
+
+inline void UDPSender::wakeUp() noexcept {
+    // Notify under the lock so that the thread cannot miss it between checking and waiting
+    std::lock_guard<std::mutex> wakeUpLock(m_wakeUpMutex);
+    m_wokenUp.store(true, std::memory_order_release);
+    m_wakeUp.notify_one();
+}
+
+inline void UDPSender::drainQueue(const Clock::time_point deadline) noexcept {
+    // While a TCP daemon cannot be reached, the messages wait in the queue
+    if (m_transport == Transport::Tcp && ((m_unsent.empty() && m_messageQueue->size() == 0) || !sendUnsent())) {
+        return;
+    }
+
+    const auto start = Clock::now();
+    std::size_t batches = 0;
+    const auto pack = [this, &batches, deadline](const char* data, const std::size_t size) {
+        // Either we don't have a place to batch our message or it would not fit, so make a new batch
+        if (batches == 0 ||
+            (!m_batches[batches - 1].empty() && m_batches[batches - 1].size() + 1 + size > m_batchLimit)) {
+            // Send the complete batches once there are enough of them, or drop them past the deadline
+            if (batches == m_batches.size()) {
+                if (Clock::now() < deadline) {
+                    sendToDaemon(m_batches.data(), batches);
+                } else {
+                    countDroppedBatches(batches);
+                }
+                batches = 0;
+            }
+            m_batches[batches++].clear();
+        }  // When there is already a batch open we need a separator when its not empty
+        else if (!m_batches[batches - 1].empty()) {
+            m_batches[batches - 1].push_back('\n');
+        }
+        // Add the new message to the batch
+        m_batches[batches - 1].append(data, size);
+    };
+    const std::size_t consumed = m_messageQueue->consume(pack);
+
+    // Send the remaining batches, the last one incomplete as it may be
+    if (batches != 0 && Clock::now() < deadline) {
+        sendToDaemon(m_batches.data(), batches);
+    } else {
+        countDroppedBatches(batches);
+    }
+
+    // Count how long the flushes which had something to send took
+    if (consumed != 0) {
+        const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+        std::size_t bucket = 0;
+        while (bucket + 1 < Stats::k_flushBuckets && elapsed >= (int64_t{1} << bucket)) {
+            ++bucket;
+        }
+        m_flushDurations[bucket].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Let the blocked producers know there is room again
+    if (m_blockedProducers.load(std::memory_order_acquire) != 0) {
+        std::lock_guard<std::mutex> drainedLock(m_drainedMutex);
+        m_drained.notify_all();
+    }
+}
+
+inline std::string UDPSender::errorMessage() const noexcept {
+    std::lock_guard<std::mutex> errorLock(m_errorMutex);
     return m_errorMessage;
 }
 
+inline void UDPSender::setErrorMessage(std::string message) noexcept {
+    std::lock_guard<std::mutex> errorLock(m_errorMutex);
+    m_errorMessage.swap(message);
+    m_hasError.store(!m_errorMessage.empty(), std::memory_order_relaxed);
+}
+
 inline bool UDPSender::initialize() noexcept {
 #ifdef _WIN32
     if (!detail::WinSockSingleton::getInstance().ok()) {
-        m_errorMessage = "WSAStartup failed: errno=" + std::to_string(SOCKET_ERRNO);
+        setErrorMessage("WSAStartup failed: errno=" + std::to_string(SOCKET_ERRNO));
     }
 #endif
 
+    // A Unix domain socket, for a daemon on the same host
+    if (m_host.compare(0, std::strlen(k_unixScheme), k_unixScheme) == 0) {
+        m_transport = Transport::Unix;
+        m_initialized = initializeUnix(m_host.substr(std::strlen(k_unixScheme)));
+        return m_initialized;
+    }
+
+    // A TCP connection, which is opened now and reopened whenever it fails
+    if (m_host.compare(0, std::strlen(k_tcpScheme), k_tcpScheme) == 0) {
+        m_transport = Transport::Tcp;
+        m_initialized = resolveInet(m_host.substr(std::strlen(k_tcpScheme)));
+        if (m_initialized) {
+            std::lock_guard<std::mutex> batchingLock(m_batchingMutex);
+            connectToDaemon();
+        }
+        return m_initialized;
+    }
+
     // Connect the socket
     m_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
     if (!detail::isValidSocket(m_socket)) {
-        m_errorMessage = "socket creation failed: errno=" + std::to_string(SOCKET_ERRNO);
+        setErrorMessage("socket creation failed: errno=" + std::to_string(SOCKET_ERRNO));
+        return false;
+    }
+    if (!resolveInet(m_host)) {
+        SOCKET_CLOSE(m_socket);
+        m_socket = k_invalidSocket;
         return false;
     }
+    m_initialized = true;
+    return true;
+}
 
-    std::memset(&m_server, 0, sizeof(m_server));
-    m_server.sin_family = AF_INET;
-    m_server.sin_port = htons(m_port);
+inline bool UDPSender::resolveInet(const std::string& host) noexcept {
+    struct sockaddr_in server;
+    std::memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(m_port);
 
-    if (inet_pton(AF_INET, m_host.c_str(), &m_server.sin_addr) == 0) {
+    if (inet_pton(AF_INET, host.c_str(), &server.sin_addr) == 0) {
         // An error code has been returned by inet_aton
 
         // Specify the criteria for selecting the socket address structure
         struct addrinfo hints;
         std::memset(&hints, 0, sizeof(hints));
         hints.ai_family = AF_INET;
-        hints.ai_socktype = SOCK_DGRAM;
+        hints.ai_socktype = m_transport == Transport::Tcp ? SOCK_STREAM : SOCK_DGRAM;
 
         // Get the address info using the hints
         struct addrinfo* results = nullptr;
-        const int ret{getaddrinfo(m_host.c_str(), nullptr, &hints, &results)};
+        const int ret{getaddrinfo(host.c_str(), nullptr, &hints, &results)};
         if (ret != 0) {
             // An error code has been returned by getaddrinfo
-            SOCKET_CLOSE(m_socket);
-            m_socket = k_invalidSocket;
-            m_errorMessage = "getaddrinfo failed: err=" + std::to_string(ret) + ", msg=" + gai_strerror(ret);
+            setErrorMessage("getaddrinfo failed: err=" + std::to_string(ret) + ", msg=" + gai_strerror(ret));
             return false;
         }
 
-        // Copy the results in m_server
+        // Copy the results in the server structure
         struct sockaddr_in* host_addr = (struct sockaddr_in*)results->ai_addr;
-        std::memcpy(&m_server.sin_addr, &host_addr->sin_addr, sizeof(struct in_addr));
+        std::memcpy(&server.sin_addr, &host_addr->sin_addr, sizeof(struct in_addr));
 
         // Free the memory allocated
         freeaddrinfo(results);
     }
 
+    std::memset(&m_server, 0, sizeof(m_server));
+    std::memcpy(&m_server, &server, sizeof(server));
+    m_serverLength = sizeof(server);
+    return true;
+}
+
+inline bool UDPSender::initializeUnix(const std::string& path) noexcept {
+#ifdef _WIN32
+    (void)path;
+    setErrorMessage("unix domain datagram sockets are not supported on this platform: host=" + m_host);
+    return false;
+#else
+    struct sockaddr_un server;
+    std::memset(&server, 0, sizeof(server));
+    server.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(server.sun_path)) {
+        setErrorMessage("invalid unix socket path: host=" + m_host);
+        return false;
+    }
+    std::memcpy(server.sun_path, path.data(), path.size());
+
+    // The socket never blocks, a full daemon buffer fails the datagram instead
+    m_socket = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (!detail::isValidSocket(m_socket)) {
+        setErrorMessage("socket creation failed: errno=" + std::to_string(SOCKET_ERRNO));
+        return false;
+    }
+    const int flags = fcntl(m_socket, F_GETFL, 0);
+    if (flags == -1 || fcntl(m_socket, F_SETFL, flags | O_NONBLOCK) == -1) {
+        setErrorMessage("fcntl failed: errno=" + std::to_string(SOCKET_ERRNO));
+        SOCKET_CLOSE(m_socket);
+        m_socket = k_invalidSocket;
+        return false;
+    }
+
+    std::memset(&m_server, 0, sizeof(m_server));
+    std::memcpy(&m_server, &server, sizeof(server));
+    m_serverLength = sizeof(server);
     return true;
+#endif
+}
+
+inline std::size_t UDPSender::pathDatagramSize() const noexcept {
+    std::size_t size = k_maxUdpPayload;
+#ifdef IP_MTU
+    // A connected socket knows the MTU of its route, less the IPv4 and UDP headers
+    const SOCKET_TYPE probe = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (!detail::isValidSocket(probe)) {
+        return size;
+    }
+    int mtu = 0;
+    socklen_t length = sizeof(mtu);
+    if (connect(probe, (const struct sockaddr*)&m_server, m_serverLength) == 0 &&
+        getsockopt(probe, IPPROTO_IP, IP_MTU, &mtu, &length) == 0 && mtu > 28) {
+        size = std::min(size, static_cast<std::size_t>(mtu - 28));
+    }
+    SOCKET_CLOSE(probe);
+#endif
+    return size;
+}
+
+inline std::string UDPSender::destination() const {
+    if (m_transport == Transport::Unix) {
+        return m_host;
+    }
+    return m_host + ":" + std::to_string(static_cast<unsigned int>(m_port));
+}
+
+inline void UDPSender::reportSendFailure(const char* call, const int error, const std::string& details) noexcept {
+    std::string message = std::string(call) + " server failed: host=" + destination() + details;
+#ifndef _WIN32
+    if (error == EAGAIN || error == EWOULDBLOCK) {
+        message += ", the socket buffer of the daemon is full";
+    }
+#else
+    (void)error;
+#endif
+    setErrorMessage(std::move(message));
+}
+
+inline bool UDPSender::connectToDaemon(const bool now) noexcept {
+    // A daemon which closed the connection is noticed when a write fails, which disconnects
+    if (detail::isValidSocket(m_socket)) {
+        return true;
+    }
+    if (!now && Clock::now() < m_nextConnect) {
+        return false;
+    }
+
+    m_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (!detail::isValidSocket(m_socket)) {
+        disconnect("socket", SOCKET_ERRNO);
+        return false;
+    }
+
+#ifdef _WIN32
+    if (connect(m_socket, (struct sockaddr*)&m_server, m_serverLength) != 0) {
+        disconnect("connect", SOCKET_ERRNO);
+        return false;
+    }
+    const DWORD timeout = static_cast<DWORD>(m_tcpTimeout);
+#else
+    // Connect without waiting longer than the timeout, then go back to blocking writes bounded by the same timeout
+    const int flags = fcntl(m_socket, F_GETFL, 0);
+    int error = flags == -1 || fcntl(m_socket, F_SETFL, flags | O_NONBLOCK) == -1 ? errno : 0;
+    if (error == 0 && connect(m_socket, (struct sockaddr*)&m_server, m_serverLength) != 0) {
+        error = errno;
+        if (error == EINPROGRESS) {
+            struct pollfd pending {};
+            pending.fd = m_socket;
+            pending.events = POLLOUT;
+            const auto timeout = std::min<uint64_t>(m_tcpTimeout, static_cast<uint64_t>(INT32_MAX));
+            const int ready = poll(&pending, 1, static_cast<int>(timeout));
+            socklen_t length = sizeof(error);
+            if (ready <= 0) {
+                error = ready == 0 ? ETIMEDOUT : errno;
+            } else if (getsockopt(m_socket, SOL_SOCKET, SO_ERROR, &error, &length) != 0) {
+                error = errno;
+            }
+        }
+    }
+    if (error == 0 && fcntl(m_socket, F_SETFL, flags) == -1) {
+        error = errno;
+    }
+    if (error != 0) {
+        disconnect("connect", error);
+        return false;
+    }
+    struct timeval timeout {};
+    timeout.tv_sec = static_cast<decltype(timeout.tv_sec)>(m_tcpTimeout / 1000);
+    timeout.tv_usec = static_cast<decltype(timeout.tv_usec)>(m_tcpTimeout % 1000 * 1000);
+#ifdef SO_NOSIGPIPE
+    const int noSignal = 1;
+    setsockopt(m_socket, SOL_SOCKET, SO_NOSIGPIPE, &noSignal, sizeof(noSignal));
+#endif
+#endif
+    setsockopt(m_socket, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+
+    m_backoff = 0;
+    return true;
+}
+
+inline void UDPSender::disconnect(const char* call, const int error) noexcept {
+    if (detail::isValidSocket(m_socket)) {
+        SOCKET_CLOSE(m_socket);
+        m_socket = k_invalidSocket;
+    }
+    countSendFailure(error);
+    reportSendFailure(call, error, ", err=" + std::to_string(error));
+
+    // Wait twice as long as last time before the next attempt
+    m_backoff = m_backoff == 0 ? m_reconnectBackoff : std::min(2 * m_backoff, m_maxReconnectBackoff);
+    m_nextConnect = Clock::now() + std::chrono::milliseconds(m_backoff);
+}
+
+inline bool UDPSender::sendUnsent(const bool now) noexcept {
+    if (!connectToDaemon(now)) {
+        return false;
+    }
+    if (m_unsent.empty()) {
+        return true;
+    }
+    std::size_t written = writeToStream(m_unsent.data(), m_unsent.size());
+    if (written < m_unsent.size() && m_partialBytes != 0) {
+        auto& partial = m_unsent[written];
+        m_unsentBytes -= partial.size();
+        skipWritten(partial, m_partialBytes);
+        m_unsentBytes += partial.size();
+        if (partial.empty()) {
+            ++written;
+        }
+    }
+    for (std::size_t i = 0; i < written; ++i) {
+        m_unsentBytes -= m_unsent[i].size();
+    }
+    m_unsent.erase(m_unsent.begin(), m_unsent.begin() + static_cast<std::ptrdiff_t>(written));
+    return m_unsent.empty();
+}
+
+inline void UDPSender::sendToStream(const std::string* batches, const std::size_t count) noexcept {
+    m_partialBytes = 0;
+    const std::size_t written = sendUnsent() ? writeToStream(batches, count) : 0;
+
+    // Keep the rest for when the connection is back, dropping the oldest beyond the capacity of the queue
+    for (std::size_t i = written; i < count; ++i) {
+        m_unsent.push_back(batches[i]);
+        if (i == written && m_partialBytes != 0) {
+            skipWritten(m_unsent.back(), m_partialBytes);
+            if (m_unsent.back().empty()) {
+                m_unsent.pop_back();
+                continue;
+            }
+        }
+        m_unsentBytes += m_unsent.back().size();
+    }
+    std::size_t dropped = 0;
+    while (m_unsentBytes > m_unsentCapacity && dropped < m_unsent.size()) {
+        const auto& oldest = m_unsent[dropped++];
+        countDrop(countMessages(oldest.data(), oldest.size()), oldest.size());
+        m_unsentBytes -= oldest.size();
+    }
+    m_unsent.erase(m_unsent.begin(), m_unsent.begin() + static_cast<std::ptrdiff_t>(dropped));
+}
+
+inline void UDPSender::skipWritten(std::string& batch, const std::size_t written) noexcept {
+    // The daemon got the lines written completely, and cannot make sense of the one torn by the failure
+    std::size_t next = std::min(written, batch.size());
+    if (next != 0 && batch[next - 1] != '\n') {
+        const std::size_t torn = batch.rfind('\n', next - 1);
+        const std::size_t start = torn == std::string::npos ? 0 : torn + 1;
+        const std::size_t end = batch.find('\n', next);
+        next = end == std::string::npos ? batch.size() : end + 1;
+        countDrop(1, (end == std::string::npos ? batch.size() : end) - start);
+    }
+    batch.erase(0, next);
+}
+
+inline std::size_t UDPSender::writeToStream(const std::string* batches, const std::size_t count) noexcept {
+    std::size_t written = 0;
+    m_partialBytes = 0;
+#ifdef _WIN32
+    std::string line;
+    for (; written < count; ++written) {
+        line.assign(batches[written]).push_back('\n');
+        for (std::size_t offset = 0; offset < line.size();) {
+            const int ret = ::send(m_socket, line.data() + offset, static_cast<int>(line.size() - offset), 0);
+            if (ret <= 0) {
+                m_partialBytes = offset;
+                disconnect("send", SOCKET_ERRNO);
+                return written;
+            }
+            offset += static_cast<std::size_t>(ret);
+        }
+        m_datagramsSent.fetch_add(1, std::memory_order_relaxed);
+    }
+#else
+#ifdef MSG_NOSIGNAL
+    constexpr int flags = MSG_NOSIGNAL;
+#else
+    constexpr int flags = 0;
+#endif
+    static char newline = '\n';
+    while (written < count) {
+        // Describe as many batches as one call takes, each followed by a newline
+        const std::size_t chunk = std::min(count - written, std::min<std::size_t>(m_batchesPerSyscall, 512));
+        m_streamBuffers.resize(2 * chunk);
+        for (std::size_t i = 0; i < chunk; ++i) {
+            const std::string& batch = batches[written + i];
+            m_streamBuffers[2 * i].iov_base = const_cast<char*>(batch.data());
+            m_streamBuffers[2 * i].iov_len = batch.size();
+            m_streamBuffers[2 * i + 1].iov_base = &newline;
+            m_streamBuffers[2 * i + 1].iov_len = 1;
+        }
+
+        // Write until everything went out, a short write leaving the rest of the buffers for the next call
+        std::size_t first = 0;
+        while (first < m_streamBuffers.size()) {
+            struct msghdr header {};
+            header.msg_iov = &m_streamBuffers[first];
+            header.msg_iovlen = m_streamBuffers.size() - first;
+            const auto ret = sendmsg(m_socket, &header, flags);
+            if (ret < 0 && errno == EINTR) {
+                continue;
+            }
+            if (ret < 0) {
+                // The batch the write failed on was written up to its remaining buffer, or fully but its newline
+                const std::size_t failed = written + first / 2;
+                const std::size_t left = first % 2 == 0 ? m_streamBuffers[first].iov_len : 0;
+                m_partialBytes = batches[failed].size() - left;
+                m_datagramsSent.fetch_add(first / 2, std::memory_order_relaxed);
+                disconnect("sendmsg", errno);
+                return failed;
+            }
+            auto remaining = static_cast<std::size_t>(ret);
+            while (first < m_streamBuffers.size() && remaining >= m_streamBuffers[first].iov_len) {
+                remaining -= m_streamBuffers[first++].iov_len;
+            }
+            if (remaining != 0) {
+                m_streamBuffers[first].iov_base = static_cast<char*>(m_streamBuffers[first].iov_base) + remaining;
+                m_streamBuffers[first].iov_len -= remaining;
+            }
+        }
+        m_datagramsSent.fetch_add(chunk, std::memory_order_relaxed);
+        written += chunk;
+    }
+#endif
+    return written;
+}
+
+inline void UDPSender::dropQueued() noexcept {
+    for (const auto& batch : m_unsent) {
+        countDrop(countMessages(batch.data(), batch.size()), batch.size());
+    }
+    m_unsent.clear();
+    m_unsentBytes = 0;
+    if (m_messageQueue) {
+        m_messageQueue->consume(
+            [this](const char* data, const std::size_t size) { countDrop(countMessages(data, size), size); });
+    }
 }
 
 inline void UDPSender::sendToDaemon(const std::string& message) noexcept {
@@ -322,26 +1344,134 @@ inline void UDPSender::sendToDaemon(const std::string& message) noexcept {
 #endif
                             0,
                             (struct sockaddr*)&m_server,
-                            sizeof(m_server));
-    if (ret == -1) {
-        m_errorMessage = "sendto server failed: host=" + m_host + ":" +
-                         std::to_string(static_cast<unsigned int>(m_port)) + ", err=" + std::to_string(SOCKET_ERRNO);
+                            m_serverLength);
+    if (ret != -1) {
+        m_datagramsSent.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        const int error = SOCKET_ERRNO;
+        countSendFailure(error);
+        reportSendFailure("sendto", error, ", err=" + std::to_string(error));
+    }
+}
+
+inline void UDPSender::sendToDaemon(const std::string* messages, const std::size_t count) noexcept {
+    if (m_transport == Transport::Tcp) {
+        sendToStream(messages, count);
+        return;
+    }
+
+    std::size_t sent = 0;
+#ifdef STATSD_HAS_IO_URING
+    if (m_ioUring) {
+        const auto address = reinterpret_cast<const struct sockaddr*>(&m_server);
+        sent = m_ioUring->send(m_socket, address, m_serverLength, messages, count,
+                               [this](const int result) { countCompletion(result); });
+    }
+#endif
+#ifdef STATSD_HAS_SENDMMSG
+    std::size_t failed = 0;
+    int lastError = 0;
+    while (!m_sendmmsgUnavailable && sent < count) {
+        // Describe the next chunk of messages
+        const std::size_t chunk = std::min(count - sent, m_messageHeaders.size());
+        for (std::size_t i = 0; i < chunk; ++i) {
+            const std::string& message = messages[sent + i];
+            m_messageBuffers[i].iov_base = const_cast<char*>(message.data());
+            m_messageBuffers[i].iov_len = message.size();
+            std::memset(&m_messageHeaders[i], 0, sizeof(struct mmsghdr));
+            m_messageHeaders[i].msg_hdr.msg_name = &m_server;
+            m_messageHeaders[i].msg_hdr.msg_namelen = m_serverLength;
+            m_messageHeaders[i].msg_hdr.msg_iov = &m_messageBuffers[i];
+            m_messageHeaders[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        // The kernel stops at the first message it fails to send, which we skip after noting the error
+        const int ret = sendmmsg(m_socket, m_messageHeaders.data(), static_cast<unsigned int>(chunk), 0);
+        if (ret >= 0) {
+            sent += static_cast<std::size_t>(ret);
+            m_datagramsSent.fetch_add(static_cast<uint64_t>(ret), std::memory_order_relaxed);
+        } else if (errno == ENOSYS) {
+            m_sendmmsgUnavailable = true;
+        } else {
+            lastError = errno;
+            countSendFailure(lastError);
+            ++failed;
+            ++sent;
+        }
+    }
+    if (failed != 0) {
+        reportSendFailure("sendmmsg", lastError,
+                          ", failed=" + std::to_string(failed) + "/" + std::to_string(count) +
+                              ", err=" + std::to_string(lastError));
+    }
+#endif
+
+    // Send whatever is left one by one
+    for (; sent < count; ++sent) {
+        sendToDaemon(messages[sent]);
     }
 }
 
 inline bool UDPSender::initialized() const noexcept {
-    return m_socket != k_invalidSocket;
+    return m_initialized;
+}
+
+inline uint64_t UDPSender::droppedMessages() const noexcept {
+    return m_droppedMessages.load(std::memory_order_relaxed);
+}
+
+inline uint64_t UDPSender::droppedBytes() const noexcept {
+    return m_droppedBytes.load(std::memory_order_relaxed);
+}
+
+inline Stats UDPSender::stats() const noexcept {
+    Stats stats;
+    stats.metricsFormatted = m_messages.load();
+    stats.bytesQueued = m_bytesQueued.load();
+    stats.datagramsSent = m_datagramsSent.load(std::memory_order_relaxed);
+    for (int error = 0; error < k_errnoSlots; ++error) {
+        const uint64_t failures = m_sendFailures[error].load(std::memory_order_relaxed);
+        if (failures != 0) {
+            stats.sendFailures[error] = failures;
+        }
+    }
+    stats.droppedMessages = droppedMessages();
+    stats.droppedBytes = droppedBytes();
+    stats.oversizedMessages = m_oversizedMessages.load(std::memory_order_relaxed);
+    stats.queueHighWaterMark = m_queueHighWaterMark.load(std::memory_order_relaxed);
+    for (std::size_t i = 0; i < Stats::k_flushBuckets; ++i) {
+        stats.flushDurations[i] = m_flushDurations[i].load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+inline bool UDPSender::usesIoUring() const noexcept {
+#ifdef STATSD_HAS_IO_URING
+    return m_ioUring != nullptr;
+#else
+    return false;
+#endif
+}
+
+inline std::size_t UDPSender::maxMessageSize() const noexcept {
+    return m_batchsize != 0 ? m_batchLimit : m_maxDatagramSize;
 }
 
 inline void UDPSender::flush() noexcept {
-    // We aquire a lock but only if we actually need to (ie there is a thread also accessing the queue)
-    auto batchingLock =
-        m_batchingThread.joinable() ? std::unique_lock<std::mutex>(m_batchingMutex) : std::unique_lock<std::mutex>();
-    // Flush the queue
-    while (!m_batchingMessageQueue.empty()) {
-        sendToDaemon(m_batchingMessageQueue.front());
-        m_batchingMessageQueue.pop_front();
+    // Let the owner queue anything it held back until now
+    if (m_flushCallback) {
+        m_flushCallback(*this);
     }
+
+    // Nothing is ever queued without batching
+    if (!m_messageQueue) {
+        return;
+    }
+
+    // Flush the partial batches of the threads, then the queue
+    collectLocalBatches(false);
+    std::lock_guard<std::mutex> batchingLock(m_batchingMutex);
+    drainQueue();
 }
 
 }  // namespace Statsd
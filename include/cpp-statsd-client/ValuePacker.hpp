@@ -0,0 +1,192 @@
+#ifndef VALUE_PACKER_HPP
+#define VALUE_PACKER_HPP
+
+#include <cpp-statsd-client/Random.hpp>
+#include <cpp-statsd-client/StringView.hpp>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace Statsd {
+
+/*!
+ *
+ * Value packer
+ *
+ * Keeps the values of timings and distributions until the next flush
+ * so that the values of a metric go out together, several per line,
+ * e.g. "prefix.key:1:2:3|ms|#tags", rather than repeating the key and
+ * the tags for every value.
+ *
+ * Like in the aggregator, a metric is identified by its serialized line
+ * without the value, i.e. "prefix.key|ms|@rate|#tags", the sample rate
+ * included as it applies to every value of the line. A line never grows
+ * beyond the maximum length it is given: once the next value would not
+ * fit, the line is handed back to be sent right away, which also bounds
+ * the memory held per metric. Where the sender takes messages of any
+ * size, over TCP or a Unix socket without batching, a line is capped
+ * at the size of a typical datagram all the same.
+ *
+ * The values only leave at a flush otherwise, so packing wants either
+ * a batching thread, which flushes every interval, or flushes by hand.
+ *
+ * The table is split into stripes picked by the thread index, each with
+ * its own lock, so that threads recording at once seldom wait on each
+ * other. At the flush, the values a metric has in several stripes are
+ * joined into one line as long as it stays within the maximum length.
+ *
+ */
+class ValuePacker final {
+public:
+    //!@name Methods
+    //!@{
+
+    //! Adds a formatted value to the metric, returns true if a complete line was moved to the full line first
+    bool add(const std::string& metric,
+             const std::size_t nameLength,
+             const std::string& value,
+             const std::size_t maxLength,
+             std::string& full) noexcept;
+
+    //! Hands the lines of every metric to the sink and resets the table
+    template <typename Sink>
+    void flush(Sink&& sink) noexcept;
+
+    //! Returns true if the lines of the type take several values, i.e. for timings, distributions and histograms
+    static bool packs(const StringView type) noexcept;
+
+    //! Returns the length a line may grow to for a sender taking messages up to the given size
+    static std::size_t maxLineLength(const std::size_t maxMessageSize) noexcept;
+
+    //! The length of a line for the senders which take messages of any size
+    static constexpr std::size_t k_unboundedLineLength{1432};
+
+    //!@}
+
+private:
+    //! A packed metric
+    struct Entry {
+        //! The length of the "prefix.key" part of the serialized metric
+        std::size_t nameLength;
+
+        //! The values, each preceded by a colon
+        std::string values;
+
+        //! The maximum length of the line, as last given
+        std::size_t maxLength;
+    };
+
+    //! Splice the values back into the serialized metric
+    static void assemble(const std::string& metric, const Entry& entry, std::string& line) noexcept;
+
+    //! The packed metrics, keyed by serialized metric
+    using Table = std::unordered_map<std::string, Entry>;
+
+    //! The number of stripes
+    static constexpr std::size_t k_stripes{16};
+
+    //! A stripe of the table, padded so that the locks of neighbouring stripes do not share a cache line
+    struct Stripe {
+        //! The packed metrics of the stripe
+        Table entries;
+
+        //! The mutex guarding them
+        std::mutex mutex;
+
+        char padding[64];
+    };
+
+    //! The stripes
+    Stripe m_stripes[k_stripes];
+};
+
+inline bool ValuePacker::add(const std::string& metric,
+                             const std::size_t nameLength,
+                             const std::string& value,
+                             const std::size_t maxLength,
+                             std::string& full) noexcept {
+    auto& stripe = m_stripes[detail::threadIndex() % k_stripes];
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    auto it = stripe.entries.find(metric);
+    if (it == stripe.entries.end()) {
+        it = stripe.entries.emplace(metric, Entry{nameLength, std::string(), maxLength}).first;
+    }
+    auto& entry = it->second;
+    entry.maxLength = maxLength;
+
+    // Hand the line back once the value would take it over the maximum length, and start the next one
+    bool complete = false;
+    if (!entry.values.empty() && metric.size() + entry.values.size() + 1 + value.size() > maxLength) {
+        assemble(metric, entry, full);
+        entry.values.clear();
+        complete = true;
+    }
+    entry.values.push_back(':');
+    entry.values.append(value);
+    return complete;
+}
+
+template <typename Sink>
+inline void ValuePacker::flush(Sink&& sink) noexcept {
+    // Swap the stripes out one at a time so that producers are only blocked for the swap, then merge them
+    Table staged;
+    std::string line;
+    for (auto& stripe : m_stripes) {
+        Table entries;
+        std::unique_lock<std::mutex> lock(stripe.mutex);
+        stripe.entries.swap(entries);
+        lock.unlock();
+
+        if (staged.empty()) {
+            staged.swap(entries);
+            continue;
+        }
+        for (auto& entry : entries) {
+            auto it = staged.find(entry.first);
+            if (it == staged.end()) {
+                staged.emplace(entry.first, std::move(entry.second));
+                continue;
+            }
+
+            // The values which would take the line over its maximum length go out on a line of their own
+            auto& kept = it->second;
+            if (entry.first.size() + kept.values.size() + entry.second.values.size() > kept.maxLength) {
+                assemble(entry.first, entry.second, line);
+                sink(line);
+                continue;
+            }
+            kept.values.append(entry.second.values);
+        }
+    }
+
+    for (const auto& entry : staged) {
+        assemble(entry.first, entry.second, line);
+        sink(line);
+    }
+}
+
+inline bool ValuePacker::packs(const StringView type) noexcept {
+    const auto is = [&type](const char* packed) {
+        return type.size() == std::strlen(packed) && std::memcmp(type.data(), packed, type.size()) == 0;
+    };
+    return is("ms") || is("d") || is("h");
+}
+
+inline std::size_t ValuePacker::maxLineLength(const std::size_t maxMessageSize) noexcept {
+    if (maxMessageSize == std::numeric_limits<std::size_t>::max()) {
+        return k_unboundedLineLength;
+    }
+    return maxMessageSize;
+}
+
+inline void ValuePacker::assemble(const std::string& metric, const Entry& entry, std::string& line) noexcept {
+    line.assign(metric, 0, entry.nameLength);
+    line.append(entry.values);
+    line.append(metric, entry.nameLength, std::string::npos);
+}
+
+}  // namespace Statsd
+
+#endif
@@ -33,17 +33,48 @@ public:
         address.sin_addr.s_addr = INADDR_ANY;
 
         // Try to bind
+        if (bind(m_socket, reinterpret_cast<const struct sockaddr*>(&address), sizeof(address)) != 0) {
+            SOCKET_CLOSE(m_socket);
+            m_socket = k_invalidSocket;
+            m_errorMessage = "bind failed: errno=" + std::to_string(SOCKET_ERRNO);
+            return;
+        }
+
+        // A large buffer, so that the tests sending many datagrams at once lose none while the receiver waits
+        const int bufferSize = 4 * 1024 * 1024;
+        setsockopt(m_socket, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<const char*>(&bufferSize), sizeof(bufferSize));
+    }
+
+#ifndef _WIN32
+    // Bind a Unix domain datagram socket at the path, with a receive queue of a few datagrams at most
+    explicit StatsdServer(const std::string& path) noexcept : m_path(path) {
+        m_socket = socket(AF_UNIX, SOCK_DGRAM, 0);
+        if (!detail::isValidSocket(m_socket)) {
+            m_errorMessage = "socket creation failed: errno=" + std::to_string(SOCKET_ERRNO);
+            return;
+        }
+
+        struct sockaddr_un address {};
+        address.sun_family = AF_UNIX;
+        std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+        unlink(path.c_str());
         if (bind(m_socket, reinterpret_cast<const struct sockaddr*>(&address), sizeof(address)) != 0) {
             SOCKET_CLOSE(m_socket);
             m_socket = k_invalidSocket;
             m_errorMessage = "bind failed: errno=" + std::to_string(SOCKET_ERRNO);
         }
     }
+#endif
 
     ~StatsdServer() {
         if (detail::isValidSocket(m_socket)) {
             SOCKET_CLOSE(m_socket);
         }
+#ifndef _WIN32
+        if (!m_path.empty()) {
+            unlink(m_path.c_str());
+        }
+#endif
     }
 
     const std::string& errorMessage() const noexcept {
@@ -56,8 +87,8 @@ public:
             return "";
         }
 
-        // Try to receive (this is blocking)
-        std::string buffer(256, '\0');
+        // Try to receive (this is blocking), room being made for a packed line
+        std::string buffer(2048, '\0');
         int string_len;
 #ifdef _WIN32
         if ((string_len = recv(m_socket, &buffer[0], static_cast<int>(buffer.size()), 0)) < 1) {
@@ -76,6 +107,84 @@ public:
 
 private:
     SOCKET_TYPE m_socket;
+    std::string m_path;
+    std::string m_errorMessage;
+};
+
+class StatsdTcpServer {
+public:
+    // Listen on the port of the loopback interface, for one connection at a time
+    explicit StatsdTcpServer(unsigned short port) noexcept {
+#ifdef _WIN32
+        if (!detail::WinSockSingleton::getInstance().ok()) {
+            m_errorMessage = "WSAStartup failed: errno=" + std::to_string(SOCKET_ERRNO);
+        }
+#endif
+        m_listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (!detail::isValidSocket(m_listener)) {
+            m_errorMessage = "socket creation failed: errno=" + std::to_string(SOCKET_ERRNO);
+            return;
+        }
+
+        // Rebinding right after a previous server closed its connections is fine
+        const int reuse = 1;
+        setsockopt(m_listener, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+        struct sockaddr_in address {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(m_listener, reinterpret_cast<const struct sockaddr*>(&address), sizeof(address)) != 0 ||
+            listen(m_listener, 1) != 0) {
+            SOCKET_CLOSE(m_listener);
+            m_listener = k_invalidSocket;
+            m_errorMessage = "bind failed: errno=" + std::to_string(SOCKET_ERRNO);
+        }
+    }
+
+    ~StatsdTcpServer() {
+        if (detail::isValidSocket(m_connection)) {
+            SOCKET_CLOSE(m_connection);
+        }
+        if (detail::isValidSocket(m_listener)) {
+            SOCKET_CLOSE(m_listener);
+        }
+    }
+
+    const std::string& errorMessage() const noexcept {
+        return m_errorMessage;
+    }
+
+    // Receive the given number of bytes from the connection, accepting it first if need be (this is blocking)
+    std::string receive(const std::size_t size) noexcept {
+        if (!detail::isValidSocket(m_connection)) {
+            m_connection = accept(m_listener, nullptr, nullptr);
+            if (!detail::isValidSocket(m_connection)) {
+                m_errorMessage = "accept failed: errno=" + std::to_string(SOCKET_ERRNO);
+                return "";
+            }
+        }
+
+        std::string buffer(size, '\0');
+        for (std::size_t received = 0; received < size;) {
+#ifdef _WIN32
+            const int ret = recv(m_connection, &buffer[received], static_cast<int>(size - received), 0);
+#else
+            const auto ret = recv(m_connection, &buffer[received], size - received, 0);
+#endif
+            if (ret < 1) {
+                m_errorMessage = "Could not recv on the connection";
+                buffer.resize(received);
+                return buffer;
+            }
+            received += static_cast<std::size_t>(ret);
+        }
+        m_errorMessage.clear();
+        return buffer;
+    }
+
+private:
+    SOCKET_TYPE m_listener = k_invalidSocket;
+    SOCKET_TYPE m_connection = k_invalidSocket;
     std::string m_errorMessage;
 };
 
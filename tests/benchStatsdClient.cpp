@@ -0,0 +1,503 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cpp-statsd-client/StatsdClient.hpp"
+
+using namespace Statsd;
+
+// The benchmarks below are not part of the test suite, they print their results for humans to compare
+// The micro benchmarks report the number of nanoseconds spent per metric, wall clock, so lower is better
+// The end to end ones send to a sink on loopback and report the throughput, the p99 latency of a call
+// and the share of the metrics which did not make it to the sink
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// A typical metric line
+const std::string k_message{"myPrefix.some.service.requests:1|c|#route:/api,status:200"};
+
+void report(const std::string& name, const Clock::duration elapsed, const uint64_t metrics) {
+    const auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    std::cout << std::left << std::setw(56) << name << std::right << std::setw(10) << std::fixed
+              << std::setprecision(1) << static_cast<double>(nanoseconds) / static_cast<double>(metrics)
+              << " ns/metric" << std::endl;
+}
+
+// The batching queue as it used to be: every producer packs batches under the same mutex as the consumer
+class LockedDequeQueue {
+public:
+    explicit LockedDequeQueue(const uint64_t batchsize) : m_batchsize(batchsize) {}
+
+    void push(const std::string& message) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_queue.empty() || m_queue.back().length() > m_batchsize) {
+            m_queue.emplace_back();
+            m_queue.back().reserve(m_batchsize + 256);
+        } else if (!m_queue.back().empty()) {
+            m_queue.back().push_back('\n');
+        }
+        m_queue.back().append(message);
+    }
+
+    uint64_t drain() {
+        std::deque<std::string> staged;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_queue.swap(staged);
+        lock.unlock();
+        return staged.size();
+    }
+
+private:
+    uint64_t m_batchsize;
+    std::deque<std::string> m_queue;
+    std::mutex m_mutex;
+};
+
+// The batching queue as it is now: producers reserve and commit into the ring, the consumer packs the batches
+class RingQueue {
+public:
+    explicit RingQueue(const uint64_t batchsize) : m_batchsize(batchsize), m_ring(4 * 1024 * 1024) {}
+
+    void push(const std::string& message) {
+        while (!m_ring.push(message.data(), message.size())) {
+            std::this_thread::yield();
+        }
+    }
+
+    uint64_t drain() {
+        uint64_t batches = 0;
+        m_ring.consume([this, &batches](const char* data, const std::size_t size) {
+            if (m_batch.length() > m_batchsize) {
+                m_batch.clear();
+                ++batches;
+            } else if (!m_batch.empty()) {
+                m_batch.push_back('\n');
+            }
+            m_batch.append(data, size);
+        });
+        return batches;
+    }
+
+private:
+    uint64_t m_batchsize;
+    RingBuffer m_ring;
+    std::string m_batch;
+};
+
+// Producers hammer the queue while a consumer drains it continuously
+template <typename Queue>
+void benchQueueContention(const std::string& name, const int producers, const uint64_t metricsPerProducer) {
+    Queue queue(1432);
+    std::atomic<bool> done{false};
+    std::thread consumer([&queue, &done] {
+        while (!done.load(std::memory_order_acquire)) {
+            queue.drain();
+            std::this_thread::yield();
+        }
+        queue.drain();
+    });
+
+    const auto start = Clock::now();
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p) {
+        threads.emplace_back([&queue, metricsPerProducer] {
+            for (uint64_t i = 0; i < metricsPerProducer; ++i) {
+                queue.push(k_message);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    const auto elapsed = Clock::now() - start;
+
+    done.store(true, std::memory_order_release);
+    consumer.join();
+    report(name + " x" + std::to_string(producers), elapsed, metricsPerProducer * static_cast<uint64_t>(producers));
+}
+
+// The value formatting as it used to be: a stream per metric, and the sample rate through std::to_string
+template <typename T>
+void formatWithStream(std::string& buffer, const T value, const float frequency) {
+    std::stringstream valueStream;
+    valueStream << std::fixed << std::setprecision(4) << value;
+    buffer.append(valueStream.str());
+    buffer.append("|g");
+    if (frequency < 1.f) {
+        buffer.append("|@0.");
+        buffer.append(std::to_string(static_cast<int>(frequency * 100)));
+    }
+}
+
+// The value formatting as it is now: straight into the buffer
+template <typename T>
+void formatInPlace(std::string& buffer, const T value, const float frequency) {
+    detail::appendValue(buffer, value, 4);
+    buffer.append("|g");
+    if (frequency < 1.f) {
+        buffer.append("|@");
+        detail::appendRate(buffer, frequency);
+    }
+}
+
+// Format the value of a metric line, the way send does
+template <typename T, typename Format>
+void benchFormatting(const std::string& name, const T value, const float frequency, Format format) {
+    constexpr uint64_t metrics = 1000000;
+    std::string buffer;
+    buffer.reserve(256);
+    std::size_t length = 0;
+
+    const auto start = Clock::now();
+    for (uint64_t i = 0; i < metrics; ++i) {
+        buffer.assign("myPrefix.some.service.requests:");
+        format(buffer, value, frequency);
+        length += buffer.size();
+    }
+    const auto elapsed = Clock::now() - start;
+
+    // Use the result so that the loop is not optimized away
+    if (length == 0) {
+        std::cout << buffer << std::endl;
+    }
+    report(name, elapsed, metrics);
+}
+
+// The sampling decision as it used to be: a distribution over a shared mt19937 for every call
+bool sampleWithSharedEngine(const float frequency) {
+    static std::mt19937 engine(42);
+    static std::mutex mutex;  // the engine was shared without one, which was a data race
+    std::lock_guard<std::mutex> lock(mutex);
+    return !(frequency < std::uniform_real_distribution<float>(0.f, 1.f)(engine));
+}
+
+// The sampling decision as it is now: a threshold compare against the generator of the thread
+bool sampleWithThreadGenerator(const float frequency) {
+    return detail::sampled(detail::threadGenerator(1, 42), frequency);
+}
+
+// Threads take sampling decisions concurrently
+void benchSampling(const std::string& name, const int threads, bool (*sample)(float)) {
+    constexpr uint64_t metrics = 1000000;
+    const uint64_t metricsPerThread = metrics / static_cast<uint64_t>(threads);
+    std::atomic<uint64_t> hits{0};
+
+    const auto start = Clock::now();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&hits, metricsPerThread, sample] {
+            uint64_t local = 0;
+            for (uint64_t i = 0; i < metricsPerThread; ++i) {
+                local += sample(.1f) ? 1u : 0u;
+            }
+            hits += local;
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    const auto elapsed = Clock::now() - start;
+
+    // Use the result so that the loop is not optimized away
+    if (hits == 0) {
+        std::cout << "no hits" << std::endl;
+    }
+    report(name + " x" + std::to_string(threads), elapsed, metricsPerThread * static_cast<uint64_t>(threads));
+}
+
+// Reads a clock over and over, as a timer does twice per scope
+template <typename Read>
+void benchClock(const std::string& name, Read read) {
+    constexpr uint64_t reads = 1000000;
+    uint64_t sum = 0;
+    const auto start = Clock::now();
+    for (uint64_t i = 0; i < reads; ++i) {
+        sum += read();
+    }
+    const auto elapsed = Clock::now() - start;
+
+    // Use the result so that the loop is not optimized away
+    if (sum == 0) {
+        std::cout << "no ticks" << std::endl;
+    }
+    report(name, elapsed, reads);
+}
+
+// The port of the sink, apart from the default one so as not to feed a real daemon
+constexpr uint16_t k_sinkPort{8126};
+
+// Receives datagrams on loopback and counts the metrics in them
+class LoopbackSink {
+public:
+    LoopbackSink() {
+        m_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        struct sockaddr_in address {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(k_sinkPort);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (!detail::isValidSocket(m_socket) ||
+            bind(m_socket, reinterpret_cast<const struct sockaddr*>(&address), sizeof(address)) != 0) {
+            std::cerr << "Cannot bind the sink to port " << k_sinkPort << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+
+        // A large buffer so that losses come from the client, and a timeout to notice the end of the traffic
+        const int bufferSize = 8 * 1024 * 1024;
+        setsockopt(m_socket, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<const char*>(&bufferSize), sizeof(bufferSize));
+#ifdef _WIN32
+        const DWORD timeout = 100;
+#else
+        struct timeval timeout {};
+        timeout.tv_usec = 100000;
+#endif
+        setsockopt(m_socket, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+
+        m_thread = std::thread([this] {
+            std::vector<char> buffer(65536);
+            while (true) {
+                const auto received = recv(m_socket, buffer.data(), buffer.size(), 0);
+                if (received > 0) {
+                    m_metrics += countValues(buffer.data(), buffer.data() + received);
+                } else if (m_stopping.load()) {
+                    return;
+                }
+            }
+        });
+    }
+
+    ~LoopbackSink() {
+        m_stopping.store(true);
+        m_thread.join();
+        SOCKET_CLOSE(m_socket);
+    }
+
+    // Wait for the traffic to stop, then return the number of metric values received and start over
+    uint64_t collect() {
+        uint64_t previous;
+        do {
+            previous = m_metrics.load();
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        } while (m_metrics.load() != previous);
+        return m_metrics.exchange(0);
+    }
+
+private:
+    // Count the values of a datagram, a packed line "key:1:2:3|ms" holding one per colon before its type
+    static uint64_t countValues(const char* first, const char* const last) {
+        uint64_t values = 0;
+        bool inValues = true;
+        for (; first != last; ++first) {
+            if (*first == '\n') {
+                inValues = true;
+            } else if (*first == '|') {
+                inValues = false;
+            } else if (*first == ':' && inValues) {
+                ++values;
+            }
+        }
+        return values;
+    }
+
+    SOCKET_TYPE m_socket;
+    std::thread m_thread;
+    std::atomic<bool> m_stopping{false};
+    std::atomic<uint64_t> m_metrics{0};
+};
+
+// Report an end to end run
+void reportRun(const std::string& name,
+               const Clock::duration elapsed,
+               const uint64_t sent,
+               const uint64_t received,
+               std::vector<Clock::duration>& latencies) {
+    const auto seconds = std::chrono::duration<double>(elapsed).count();
+    std::sort(latencies.begin(), latencies.end());
+    const auto p99 = latencies.empty() ? Clock::duration::zero() : latencies[latencies.size() * 99 / 100];
+    const auto loss = sent > received ? static_cast<double>(sent - received) / static_cast<double>(sent) : 0.;
+    std::cout << std::left << std::setw(56) << name << std::right << std::fixed << std::setprecision(2)
+              << std::setw(10) << static_cast<double>(sent) / seconds / 1e6 << " M/s" << std::setw(10)
+              << std::chrono::duration_cast<std::chrono::nanoseconds>(p99).count() << " ns p99" << std::setw(9)
+              << 100 * loss << " % loss" << std::endl;
+}
+
+// A scenario: which client, which metric and how many producer threads
+struct Scenario {
+    std::string name;
+    uint64_t batchsize;
+    int gaugePrecision;
+    std::size_t tags;
+    bool gauge;
+    int threads;
+    bool ioUring;
+    std::size_t shards;
+    bool localBatches;
+    std::size_t constantTags;
+    bool packValues;
+};
+
+// Producers record metrics through one client, every call of some of them is timed
+void benchSend(LoopbackSink& sink, const Scenario& scenario, const uint64_t metrics) {
+    constexpr uint64_t timedEvery{16};
+    const uint64_t metricsPerThread = metrics / static_cast<uint64_t>(scenario.threads);
+    std::vector<std::string> tags;
+    for (std::size_t i = 0; i < scenario.tags; ++i) {
+        tags.push_back("tag" + std::to_string(i) + ":value" + std::to_string(i));
+    }
+    std::vector<std::vector<Clock::duration>> latencies(static_cast<std::size_t>(scenario.threads));
+
+    Clock::duration elapsed;
+    {
+        ClientOptions options;
+        options.sender.queueCapacity = 64 * 1024 * 1024;
+        options.sender.ioUring = scenario.ioUring;
+        options.shards = scenario.shards;
+        options.sender.threadLocalBatches = scenario.localBatches;
+        options.packValues = scenario.packValues;
+        for (std::size_t i = 0; i < scenario.constantTags; ++i) {
+            options.constantTags.push_back("tag" + std::to_string(i) + ":value" + std::to_string(i));
+        }
+        StatsdClient client("127.0.0.1", k_sinkPort, "bench", scenario.batchsize, 10, scenario.gaugePrecision, options);
+
+        const auto start = Clock::now();
+        std::vector<std::thread> threads;
+        for (std::size_t t = 0; t < latencies.size(); ++t) {
+            threads.emplace_back([&client, &scenario, &tags, &latencies, t, metricsPerThread] {
+                auto& timings = latencies[t];
+                timings.reserve(metricsPerThread / timedEvery + 1);
+                for (uint64_t i = 0; i < metricsPerThread; ++i) {
+                    const bool timed = i % timedEvery == 0;
+                    const auto before = timed ? Clock::now() : Clock::time_point();
+                    if (scenario.gauge) {
+                        client.gauge("some.service.gauge", 123.456789 + static_cast<double>(i), 1.f, tags);
+                    } else if (scenario.packValues) {
+                        client.timing("some.service.latency", static_cast<unsigned int>(i % 1000), 1.f, tags);
+                    } else {
+                        client.increment("some.service.requests", 1.f, tags);
+                    }
+                    if (timed) {
+                        timings.push_back(Clock::now() - before);
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        elapsed = Clock::now() - start;
+    }
+
+    std::vector<Clock::duration> all;
+    for (const auto& timings : latencies) {
+        all.insert(all.end(), timings.begin(), timings.end());
+    }
+    const uint64_t sent = metricsPerThread * static_cast<uint64_t>(scenario.threads);
+    reportRun(scenario.name, elapsed, sent, sink.collect(), all);
+}
+
+// The cost of flushing a queue of metrics by hand
+void benchFlush(LoopbackSink& sink, const uint64_t batchsize, const uint64_t metrics, const bool ioUring) {
+    constexpr int rounds{10};
+    std::vector<Clock::duration> latencies;
+    Clock::duration elapsed{};
+    {
+        ClientOptions options;
+        options.sender.queueCapacity = 64 * 1024 * 1024;
+        options.sender.ioUring = ioUring;
+        StatsdClient client("127.0.0.1", k_sinkPort, "bench", batchsize, 0, 4, options);
+        for (int round = 0; round < rounds; ++round) {
+            for (uint64_t i = 0; i < metrics; ++i) {
+                client.increment("some.service.requests");
+            }
+            const auto start = Clock::now();
+            client.flush();
+            latencies.push_back(Clock::now() - start);
+            elapsed += latencies.back();
+        }
+    }
+    const uint64_t sent = metrics * rounds;
+    const std::string name = "  flush of " + std::to_string(metrics) + " metrics, batch size " +
+                             std::to_string(batchsize) + (ioUring ? ", io_uring" : "");
+    reportRun(name, elapsed, sent, sink.collect(), latencies);
+}
+
+}  // namespace
+
+int main() {
+    constexpr uint64_t metrics = 1000000;
+
+    std::cout << "Batching queue contention" << std::endl;
+    for (const int producers : {1, 4, 16, 32}) {
+        const uint64_t metricsPerProducer = metrics / static_cast<uint64_t>(producers);
+        benchQueueContention<LockedDequeQueue>("  std::deque + std::mutex", producers, metricsPerProducer);
+        benchQueueContention<RingQueue>("  RingBuffer", producers, metricsPerProducer);
+    }
+
+    std::cout << "Value formatting" << std::endl;
+    benchFormatting("  integer, std::stringstream", 1227, 1.f, formatWithStream<int>);
+    benchFormatting("  integer, in place", 1227, 1.f, formatInPlace<int>);
+    benchFormatting("  gauge, std::stringstream", -123.456789, 1.f, formatWithStream<double>);
+    benchFormatting("  gauge, in place", -123.456789, 1.f, formatInPlace<double>);
+    benchFormatting("  sampled integer, std::stringstream", 1227, .1f, formatWithStream<int>);
+    benchFormatting("  sampled integer, in place", 1227, .1f, formatInPlace<int>);
+
+    std::cout << "Sampling" << std::endl;
+    for (const int threads : {1, 4, 16}) {
+        benchSampling("  std::mt19937 + uniform_real_distribution", threads, sampleWithSharedEngine);
+        benchSampling("  per-thread xoshiro256**", threads, sampleWithThreadGenerator);
+    }
+
+    std::cout << "Clock reads" << std::endl;
+    benchClock("  std::chrono::steady_clock", [] {
+        return static_cast<uint64_t>(Clock::now().time_since_epoch().count());
+    });
+    detail::TickClock::now();
+    benchClock(std::string("  tick clock, ") + (detail::TickClock::usesTsc() ? "tsc" : "steady clock"),
+               [] { return detail::TickClock::now(); });
+
+    std::cout << "End to end, over loopback" << std::endl;
+    LoopbackSink sink;
+    constexpr uint64_t sent = 200000;
+    const std::vector<Scenario> scenarios{
+        {"  unbatched", 0, 4, 0, false, 1, false, 1, false, 0, false},
+        {"  batched", 1432, 4, 0, false, 1, false, 1, false, 0, false},
+        {"  batched, 2 tags", 1432, 4, 2, false, 1, false, 1, false, 0, false},
+        {"  batched, 8 tags", 1432, 4, 8, false, 1, false, 1, false, 0, false},
+        {"  batched, 8 constant tags", 1432, 4, 0, false, 1, false, 1, false, 8, false},
+        {"  batched gauge, precision 0", 1432, 0, 0, true, 1, false, 1, false, 0, false},
+        {"  batched gauge, precision 4", 1432, 4, 0, true, 1, false, 1, false, 0, false},
+        {"  batched gauge, precision 10", 1432, 10, 0, true, 1, false, 1, false, 0, false},
+        {"  unbatched x4", 0, 4, 0, false, 4, false, 1, false, 0, false},
+        {"  batched x4", 1432, 4, 0, false, 4, false, 1, false, 0, false},
+        {"  batched x16", 1432, 4, 0, false, 16, false, 1, false, 0, false},
+        {"  batched x64", 1432, 4, 0, false, 64, false, 1, false, 0, false},
+        {"  batched x16, 4 shards", 1432, 4, 0, false, 16, false, 4, false, 0, false},
+        {"  batched x64, 16 shards", 1432, 4, 0, false, 64, false, 16, false, 0, false},
+        {"  batched, io_uring", 1432, 4, 0, false, 1, true, 1, false, 0, false},
+        {"  batched x16, io_uring", 1432, 4, 0, false, 16, true, 1, false, 0, false},
+        {"  batched, thread-local batches", 1432, 4, 0, false, 1, false, 1, true, 0, false},
+        {"  batched x16, thread-local batches", 1432, 4, 0, false, 16, false, 1, true, 0, false},
+        {"  batched timings, packed values", 1432, 4, 0, false, 1, false, 1, false, 0, true},
+    };
+    for (const auto& scenario : scenarios) {
+        benchSend(sink, scenario, sent);
+    }
+    for (const bool ioUring : {false, true}) {
+        for (const uint64_t batchsize : {512u, 1432u, 8192u}) {
+            benchFlush(sink, batchsize, 10000, ioUring);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,451 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifndef _WIN32
+#include <time.h>
+#endif
+
+#include "cpp-statsd-client/StatsdClient.hpp"
+
+using namespace Statsd;
+
+// The load generator drives one client from many threads for a fixed duration, against a receiver on loopback
+// It reports the throughput, the CPU spent per metric, the peak memory of the queues and the loss of every key,
+// to size the batch size and the send interval before a rollout, e.g.
+//
+//   statsd-loadgen --threads 16 --duration 10 --mix c=6,g=1,ms=2,s=1 --keys 1000 --tags 3 --batchsize 1432
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// The types of metrics the threads record
+const char* const k_types[] = {"c", "g", "ms", "s"};
+constexpr std::size_t k_typeCount{4};
+
+// The settings of a run
+struct Settings {
+    int threads = 4;
+    double duration = 10.;
+    std::vector<unsigned int> mix{6, 1, 2, 1};
+    std::size_t keys = 100;
+    std::size_t tags = 2;
+    float rate = 1.f;
+    uint64_t batchsize = 1432;
+    uint64_t sendInterval = 1000;
+    std::size_t shards = 1;
+    std::size_t queueCapacity = 4 * 1024 * 1024;
+    bool packValues = false;
+    uint16_t port = 8126;
+    std::size_t top = 20;
+};
+
+void usage(const char* name) {
+    std::cerr << "Usage: " << name << " [options]\n"
+              << "  --threads N       producer threads (4)\n"
+              << "  --duration S      seconds to run for (10)\n"
+              << "  --mix c=W,g=W,ms=W,s=W\n"
+              << "                    weights of counters, gauges, timings and sets (c=6,g=1,ms=2,s=1)\n"
+              << "  --keys N          distinct keys per type (100)\n"
+              << "  --tags N          tags per metric (2)\n"
+              << "  --rate F          sample rate, the loss per key is estimated below 1 (1)\n"
+              << "  --batchsize N     batch size in bytes, 0 to send unbatched (1432)\n"
+              << "  --interval MS     send interval in milliseconds, 0 to flush by hand only (1000)\n"
+              << "  --shards N        senders the metrics are spread over (1)\n"
+              << "  --queue BYTES     capacity of the queue of each sender (4194304)\n"
+              << "  --pack            pack the values of timings into multi-value lines\n"
+              << "  --port N          port of the receiver on loopback (8126)\n"
+              << "  --top N           keys listed in the loss report, the lossiest first (20)\n";
+    std::exit(EXIT_FAILURE);
+}
+
+// Parse the weights of the metric types, e.g. "c=6,g=1,ms=2,s=1", the types left out weighing 0
+bool parseMix(const std::string& text, std::vector<unsigned int>& mix) {
+    mix.assign(k_typeCount, 0);
+    std::size_t start = 0;
+    while (start < text.size()) {
+        auto end = text.find(',', start);
+        end = end == std::string::npos ? text.size() : end;
+        const auto item = text.substr(start, end - start);
+        const auto equal = item.find('=');
+        if (equal == std::string::npos) {
+            return false;
+        }
+        const auto type = item.substr(0, equal);
+        const auto found = std::find_if(std::begin(k_types), std::end(k_types), [&type](const char* known) {
+            return type == known;
+        });
+        if (found == std::end(k_types)) {
+            return false;
+        }
+        mix[static_cast<std::size_t>(found - std::begin(k_types))] =
+            static_cast<unsigned int>(std::strtoul(item.c_str() + equal + 1, nullptr, 10));
+        start = end + 1;
+    }
+    return std::any_of(mix.begin(), mix.end(), [](const unsigned int weight) { return weight != 0; });
+}
+
+Settings parseSettings(const int argc, char** argv) {
+    Settings settings;
+    for (int i = 1; i < argc; ++i) {
+        const std::string option = argv[i];
+        if (option == "--pack") {
+            settings.packValues = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+        }
+        const std::string value = argv[++i];
+        if (option == "--threads") {
+            settings.threads = std::max(1, std::atoi(value.c_str()));
+        } else if (option == "--duration") {
+            settings.duration = std::atof(value.c_str());
+        } else if (option == "--mix") {
+            if (!parseMix(value, settings.mix)) {
+                usage(argv[0]);
+            }
+        } else if (option == "--keys") {
+            settings.keys = std::max<std::size_t>(1, std::strtoul(value.c_str(), nullptr, 10));
+        } else if (option == "--tags") {
+            settings.tags = std::strtoul(value.c_str(), nullptr, 10);
+        } else if (option == "--rate") {
+            settings.rate = std::max(0.f, std::min(1.f, static_cast<float>(std::atof(value.c_str()))));
+        } else if (option == "--batchsize") {
+            settings.batchsize = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (option == "--interval") {
+            settings.sendInterval = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (option == "--shards") {
+            settings.shards = std::strtoul(value.c_str(), nullptr, 10);
+        } else if (option == "--queue") {
+            settings.queueCapacity = std::strtoul(value.c_str(), nullptr, 10);
+        } else if (option == "--port") {
+            settings.port = static_cast<uint16_t>(std::atoi(value.c_str()));
+        } else if (option == "--top") {
+            settings.top = std::strtoul(value.c_str(), nullptr, 10);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    return settings;
+}
+
+// The CPU time spent by the process and by the calling thread, in seconds
+#ifdef _WIN32
+double seconds(const FILETIME& time) {
+    return static_cast<double>((static_cast<uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime) * 1e-7;
+}
+
+double processCpuSeconds() {
+    FILETIME creation, exit, kernel, user;
+    GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+    return seconds(kernel) + seconds(user);
+}
+
+double threadCpuSeconds() {
+    FILETIME creation, exit, kernel, user;
+    GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user);
+    return seconds(kernel) + seconds(user);
+}
+#else
+double cpuSeconds(const clockid_t clock) {
+    struct timespec time {};
+    clock_gettime(clock, &time);
+    return static_cast<double>(time.tv_sec) + static_cast<double>(time.tv_nsec) * 1e-9;
+}
+
+double processCpuSeconds() {
+    return cpuSeconds(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+double threadCpuSeconds() {
+    return cpuSeconds(CLOCK_THREAD_CPUTIME_ID);
+}
+#endif
+
+// What a key received: its values, and those values scaled by their sample rate
+struct Received {
+    uint64_t values = 0;
+    double scaled = 0.;
+};
+
+// Receives datagrams on loopback and counts the values of every key in them
+class Receiver {
+public:
+    explicit Receiver(const uint16_t port) {
+        m_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        struct sockaddr_in address {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (!detail::isValidSocket(m_socket) ||
+            bind(m_socket, reinterpret_cast<const struct sockaddr*>(&address), sizeof(address)) != 0) {
+            std::cerr << "Cannot bind the receiver to port " << port << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+
+        // A large buffer so that losses come from the client, and a timeout to notice the end of the traffic
+        const int bufferSize = 32 * 1024 * 1024;
+        setsockopt(m_socket, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<const char*>(&bufferSize), sizeof(bufferSize));
+#ifdef _WIN32
+        const DWORD timeout = 100;
+#else
+        struct timeval timeout {};
+        timeout.tv_usec = 100000;
+#endif
+        setsockopt(m_socket, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+
+        m_thread = std::thread([this] {
+            std::vector<char> buffer(65536);
+            while (true) {
+                const auto received = recv(m_socket, buffer.data(), buffer.size(), 0);
+                if (received > 0) {
+                    parse(buffer.data(), buffer.data() + received);
+                } else if (m_stopping.load()) {
+                    m_cpuSeconds = threadCpuSeconds();
+                    return;
+                }
+            }
+        });
+    }
+
+    ~Receiver() {
+        stop();
+        SOCKET_CLOSE(m_socket);
+    }
+
+    // Wait for the traffic to stop, then stop receiving
+    void stop() {
+        if (!m_thread.joinable()) {
+            return;
+        }
+        uint64_t previous;
+        do {
+            previous = m_lines.load();
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        } while (m_lines.load() != previous);
+        m_stopping.store(true);
+        m_thread.join();
+    }
+
+    // The values received by key, once stopped
+    const std::unordered_map<std::string, Received>& keys() const {
+        return m_keys;
+    }
+
+    // The CPU time the receiver spent, once stopped
+    double cpuSeconds() const {
+        return m_cpuSeconds;
+    }
+
+private:
+    // Count the values of the lines of a datagram, "key:1:2|ms|@0.5|#tags" holding two values sampled at 0.5
+    void parse(const char* begin, const char* end) {
+        while (begin < end) {
+            const char* newline = std::find(begin, end, '\n');
+            const char* colon = std::find(begin, newline, ':');
+            const char* pipe = std::find(colon, newline, '|');
+            if (colon != newline && pipe != newline) {
+                const auto values = static_cast<uint64_t>(std::count(colon, pipe, ':'));
+                double rate = 1.;
+                const char* at = std::find(pipe + 1, newline, '|');
+                if (newline - at > 2 && at[1] == '@') {
+                    rate = std::atof(std::string(at + 2, newline).c_str());
+                }
+                m_key.assign(begin, colon);
+                auto& key = m_keys[m_key];
+                key.values += values;
+                key.scaled += rate > 0. ? static_cast<double>(values) / rate : 0.;
+            }
+            m_lines.fetch_add(1, std::memory_order_relaxed);
+            begin = newline + 1;
+        }
+    }
+
+    SOCKET_TYPE m_socket;
+    std::thread m_thread;
+    std::atomic<bool> m_stopping{false};
+    std::atomic<uint64_t> m_lines{0};
+    std::unordered_map<std::string, Received> m_keys;
+    std::string m_key;
+    double m_cpuSeconds = 0.;
+};
+
+// The metrics a producer thread records until the deadline, counting its calls per type and key
+void produce(const StatsdClient& client,
+             const Settings& settings,
+             const std::vector<std::string>& keys,
+             const std::vector<std::string>& tags,
+             const Clock::time_point deadline,
+             const unsigned int seed,
+             std::vector<uint64_t>& calls) {
+    // The type is drawn by weight, the key uniformly, with a generator of the thread's own
+    std::vector<unsigned int> bounds;
+    unsigned int total = 0;
+    for (const auto weight : settings.mix) {
+        total += weight;
+        bounds.push_back(total);
+    }
+    std::minstd_rand random(seed);
+    calls.assign(keys.size(), 0);
+
+    // The clock is only read every so many calls, so that it does not weigh on the throughput
+    constexpr uint64_t k_callsPerClockRead{256};
+    for (uint64_t i = 0;; ++i) {
+        if (i % k_callsPerClockRead == 0 && Clock::now() >= deadline) {
+            return;
+        }
+        const unsigned int draw = static_cast<unsigned int>(random()) % total;
+        const auto type = static_cast<std::size_t>(std::upper_bound(bounds.begin(), bounds.end(), draw) -
+                                                   bounds.begin());
+        const std::size_t index = type * settings.keys + static_cast<std::size_t>(random()) % settings.keys;
+        const auto value = static_cast<unsigned int>(random() % 1000);
+        switch (type) {
+            case 0:
+                client.increment(keys[index], settings.rate, tags);
+                break;
+            case 1:
+                client.gauge(keys[index], value, settings.rate, tags);
+                break;
+            case 2:
+                client.timing(keys[index], value, settings.rate, tags);
+                break;
+            default:
+                client.set(keys[index], value, settings.rate, tags);
+                break;
+        }
+        ++calls[index];
+    }
+}
+
+// A key of the loss report
+struct Loss {
+    std::string key;
+    uint64_t sent;
+    double received;
+    double lost;
+};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    const Settings settings = parseSettings(argc, argv);
+    std::vector<std::string> keys;
+    for (const auto type : k_types) {
+        for (std::size_t k = 0; k < settings.keys; ++k) {
+            keys.push_back(std::string(type) + ".k" + std::to_string(k));
+        }
+    }
+    std::vector<std::string> tags;
+    for (std::size_t i = 0; i < settings.tags; ++i) {
+        tags.push_back("tag" + std::to_string(i) + ":value" + std::to_string(i));
+    }
+
+    const double cpuBefore = processCpuSeconds();
+    Receiver receiver(settings.port);
+    std::vector<std::vector<uint64_t>> calls(static_cast<std::size_t>(settings.threads));
+    Clock::duration elapsed;
+    Stats stats;
+    {
+        ClientOptions options;
+        options.shards = settings.shards;
+        options.packValues = settings.packValues;
+        options.sender.queueCapacity = settings.queueCapacity;
+        StatsdClient client(
+            "127.0.0.1", settings.port, "loadgen", settings.batchsize, settings.sendInterval, 4, options);
+        if (!client.errorMessage().empty()) {
+            std::cerr << client.errorMessage() << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        const auto start = Clock::now();
+        const auto deadline = start + std::chrono::duration_cast<Clock::duration>(
+                                          std::chrono::duration<double>(settings.duration));
+        std::vector<std::thread> threads;
+        for (std::size_t t = 0; t < calls.size(); ++t) {
+            threads.emplace_back([&, t] {
+                produce(client, settings, keys, tags, deadline, static_cast<unsigned int>(t + 1), calls[t]);
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        elapsed = Clock::now() - start;
+
+        // The values held back for the flush and the queues are sent before the stats are read
+        client.flush();
+        stats = client.stats();
+    }
+    receiver.stop();
+    const double cpu = processCpuSeconds() - cpuBefore - receiver.cpuSeconds();
+
+    // The calls of every key, and what the receiver got of them
+    uint64_t sent = 0;
+    std::vector<Loss> losses;
+    double totalReceived = 0.;
+    for (std::size_t index = 0; index < keys.size(); ++index) {
+        uint64_t keySent = 0;
+        for (const auto& threadCalls : calls) {
+            keySent += threadCalls[index];
+        }
+        if (keySent == 0) {
+            continue;
+        }
+        const auto found = receiver.keys().find("loadgen." + keys[index]);
+        double received = 0.;
+        if (found != receiver.keys().end()) {
+            received = settings.rate < 1.f ? found->second.scaled : static_cast<double>(found->second.values);
+        }
+        sent += keySent;
+        totalReceived += received;
+        losses.push_back({keys[index], keySent, received, static_cast<double>(keySent) - received});
+    }
+    std::sort(losses.begin(), losses.end(), [](const Loss& left, const Loss& right) { return left.lost > right.lost; });
+
+    const double seconds = std::chrono::duration<double>(elapsed).count();
+    const bool estimated = settings.rate < 1.f;
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "Sent " << sent << " metrics from " << settings.threads << " threads in " << seconds << " s"
+              << std::endl;
+    std::cout << std::left << std::setw(32) << "  throughput" << std::right << std::setw(14)
+              << static_cast<double>(sent) / seconds / 1e6 << " M metrics/s" << std::endl;
+    std::cout << std::left << std::setw(32) << "  CPU per metric" << std::right << std::setw(14)
+              << (sent != 0 ? cpu * 1e9 / static_cast<double>(sent) : 0.) << " ns" << std::endl;
+    std::cout << std::left << std::setw(32) << "  queue peak, largest shard" << std::right << std::setw(14)
+              << static_cast<double>(stats.queueHighWaterMark) / 1024. << " KiB" << std::endl;
+    std::cout << std::left << std::setw(32) << "  queue capacity per shard" << std::right << std::setw(14)
+              << static_cast<double>(settings.queueCapacity) / 1024. << " KiB" << std::endl;
+    std::cout << std::left << std::setw(32) << "  dropped by the client" << std::right << std::setw(14)
+              << stats.droppedMessages << " messages, " << stats.oversizedMessages << " oversized" << std::endl;
+    uint64_t failures = 0;
+    for (const auto& failure : stats.sendFailures) {
+        failures += failure.second;
+    }
+    std::cout << std::left << std::setw(32) << "  failed sends" << std::right << std::setw(14) << failures
+              << " datagrams" << std::endl;
+    const double lost = static_cast<double>(sent) - totalReceived;
+    std::cout << std::left << std::setw(32) << (estimated ? "  loss, estimated" : "  loss") << std::right
+              << std::setw(14) << (sent != 0 ? 100. * lost / static_cast<double>(sent) : 0.) << " %" << std::endl;
+
+    std::cout << "Loss per key" << (estimated ? ", estimated from the sample rate" : "") << ", the lossiest first"
+              << std::endl;
+    std::cout << std::left << std::setw(32) << "  key" << std::right << std::setw(14) << "sent" << std::setw(14)
+              << "received" << std::setw(14) << "lost" << std::setw(10) << "%" << std::endl;
+    for (std::size_t i = 0; i < std::min(settings.top, losses.size()); ++i) {
+        const auto& loss = losses[i];
+        std::cout << std::left << std::setw(32) << "  " + loss.key << std::right << std::setw(14) << loss.sent
+                  << std::setw(14) << loss.received << std::setw(14) << loss.lost << std::setw(10)
+                  << 100. * loss.lost / static_cast<double>(loss.sent) << std::endl;
+    }
+    return EXIT_SUCCESS;
+}
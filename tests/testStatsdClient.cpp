@@ -1,10 +1,44 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <new>
+#include <numeric>
+#include <sstream>
 
 #include "StatsdServer.hpp"
 #include "cpp-statsd-client/StatsdClient.hpp"
 
 using namespace Statsd;
 
+// Count the heap allocations while asked to, to check that sending a metric does not allocate
+std::atomic<bool> countingAllocations{false};
+std::atomic<uint64_t> allocations{0};
+
+void* operator new(std::size_t size) {
+    if (countingAllocations.load(std::memory_order_relaxed)) {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (void* pointer = std::malloc(size == 0 ? 1 : size)) {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept {
+    std::free(pointer);
+}
+
 // Each test suite below spawns a thread to recv the client messages over UDP as if it were a real statsd server
 // Note that we could just synchronously recv metrics and not use a thread but doing the test async has the
 // advantage that we can test the threaded batching mode in a straightforward way. The server thread basically
@@ -19,7 +53,7 @@ void mock(StatsdServer& server, std::vector<std::string>& messages) {
         do {
             // Keep this message
             auto end = recvd.find('\n', ++start);
-            messages.emplace_back(recvd.substr(start, end));
+            messages.emplace_back(recvd.substr(start, end == std::string::npos ? end : end - start));
             start = end;
 
             // Bail if we found the special quit message
@@ -51,6 +85,991 @@ void testErrorConditions() {
     // Resolve a rubbish ip and make sure initialization failed
     StatsdClient client{"256.256.256.256", 8125, "myPrefix", 20};
     throwOnError(client, false, "Should not be able to resolve a ridiculous ip");
+
+    // Every shard reports its error
+    ClientOptions options;
+    options.shards = 2;
+    client.setConfig("256.256.256.256", 8125, "myPrefix", 20, 1000, 4, options);
+    if (client.errorMessage().find("; ") == std::string::npos) {
+        throw std::runtime_error("The errors of all the shards should be reported: " + client.errorMessage());
+    }
+}
+
+void testRingBuffer() {
+    // Wrap around a small ring many times, reserving and committing by hand
+    RingBuffer ring(256);
+    std::string consumed;
+    for (int i = 0; i < 1000; ++i) {
+        const std::string record = "record" + std::to_string(i);
+        auto reservation = ring.reserve(record.size());
+        if (reservation.data == nullptr) {
+            throw std::runtime_error("Ring should have room for a single record");
+        }
+        std::memcpy(reservation.data, record.data(), record.size());
+        ring.commit(reservation);
+        ring.consume([&consumed](const char* data, std::size_t size) { consumed.assign(data, size); });
+        if (consumed != record) {
+            std::cerr << "Expected: " << record << " but got: " << consumed << std::endl;
+            throw std::runtime_error("Incorrect record consumed");
+        }
+    }
+
+    // Fill it up until it refuses records, which must not be consumed
+    std::size_t pushed = 0;
+    while (ring.push("0123456789abcdef", 16)) {
+        ++pushed;
+    }
+    if (pushed == 0 || ring.size() > ring.capacity() || ring.consume([](const char*, std::size_t) {}) != pushed) {
+        throw std::runtime_error("Ring should hold records up to its capacity");
+    }
+
+    // Several producers, a single consumer, every record comes out once and in order per producer
+    constexpr int producers = 4;
+    constexpr int records = 10000;
+    RingBuffer shared(4096);
+    std::vector<std::thread> threads;
+    std::vector<int> next(producers, 0);
+    for (int p = 0; p < producers; ++p) {
+        threads.emplace_back([&shared, p] {
+            for (int i = 0; i < records; ++i) {
+                const int record[2] = {p, i};
+                while (!shared.push(reinterpret_cast<const char*>(record), sizeof(record))) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    int total = 0;
+    while (total < producers * records) {
+        total += static_cast<int>(shared.consume([&next](const char* data, std::size_t size) {
+            int record[2];
+            std::memcpy(record, data, std::min(size, sizeof(record)));
+            if (size != sizeof(record) || record[1] != next[static_cast<std::size_t>(record[0])]++) {
+                throw std::runtime_error("Records must come out in order per producer");
+            }
+        }));
+        std::this_thread::yield();
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void testSampling() {
+    // The draws follow the frequency
+    detail::Xoshiro256 generator;
+    generator.seed(42);
+    int hits = 0;
+    for (int i = 0; i < 100000; ++i) {
+        hits += detail::sampled(generator, .25f) ? 1 : 0;
+    }
+    if (hits < 24000 || hits > 26000) {
+        throw std::runtime_error("Sampling should follow the frequency");
+    }
+
+    // A thread keeps drawing from its generator for a stream, and starts over for a new stream with the same seed
+    const uint64_t first = detail::newRandomStream();
+    const uint64_t draw = detail::threadGenerator(first, 42).next();
+    if (detail::threadGenerator(first, 42).next() == draw) {
+        throw std::runtime_error("The generator of a stream should be kept by the thread");
+    }
+    if (detail::threadGenerator(detail::newRandomStream(), 42).next() != draw) {
+        throw std::runtime_error("Seeding again should reproduce the draws");
+    }
+
+    // Other threads draw from generators of their own
+    uint64_t other = draw;
+    std::thread([first, &other] { other = detail::threadGenerator(first, 42).next(); }).join();
+    if (other == draw) {
+        throw std::runtime_error("Threads should not share a generator");
+    }
+}
+
+void throwOnInaccurate(const double actual, const double expected, const std::string& what) {
+    if (std::fabs(actual - expected) > 0.01 * expected) {
+        std::cerr << "Expected " << what << ": " << expected << " but got: " << actual << std::endl;
+        throw std::runtime_error("Inaccurate sketch");
+    }
+}
+
+void testSketches() {
+    // Percentiles are within the relative accuracy, the maximum and count are exact
+    LatencySketch sketch(0.01, 2048);
+    LatencySketch low(0.01, 2048), high(0.01, 2048);
+    for (int i = 1; i <= 10000; ++i) {
+        sketch.add(i);
+        (i <= 5000 ? low : high).add(i);
+    }
+    throwOnInaccurate(sketch.quantile(0.5), 5000, "p50");
+    throwOnInaccurate(sketch.quantile(0.99), 9900, "p99");
+    if (sketch.max() != 10000 || sketch.count() != 10000) {
+        throw std::runtime_error("Sketch maximum and count should be exact");
+    }
+
+    // Merged sketches are the sketch of all the values
+    low.merge(high);
+    if (low.quantile(0.5) != sketch.quantile(0.5) || low.quantile(0.99) != sketch.quantile(0.99) ||
+        low.count() != sketch.count() || low.max() != sketch.max()) {
+        throw std::runtime_error("Merged sketches should match");
+    }
+
+    // With few bins the lowest values are merged, the tail stays accurate
+    LatencySketch bounded(0.01, 64);
+    for (int i = 1; i <= 10000; ++i) {
+        bounded.add(i);
+    }
+    throwOnInaccurate(bounded.quantile(0.99), 9900, "bounded p99");
+
+    // The client emits the percentiles, maximum and count of each timing at flush
+    StatsdServer server;
+    throwOnError(server);
+    ClientOptions options;
+    options.sketchTimings = true;
+    options.sketch.percentiles = {50, 99.9};
+    StatsdClient client("localhost", 8125, "sketch", 0, 0, 0, options);
+    const auto handle = client.metric("handle", "ms");
+    for (unsigned int i = 1; i <= 1000; ++i) {
+        client.timing("myTiming", i, 0.01f, {"foo"});
+    }
+    handle.record(12.5);
+
+    // Threads sketch apart, their sketches being merged at the flush
+    std::vector<std::thread> threads;
+    for (unsigned int t = 0; t < 4; ++t) {
+        threads.emplace_back([&client, t] {
+            for (unsigned int i = 1; i <= 250; ++i) {
+                client.timing("threaded", 250 * t + i);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    // Nothing is sketched at a frequency of 0, like nothing is sent without sketches
+    client.timing("never", 1, 0.f);
+    {
+        const auto never = client.time("never", 0.f);
+    }
+    client.flush();
+    std::vector<std::string> lines;
+    for (int i = 0; i < 12; ++i) {
+        lines.push_back(server.receive());
+    }
+    std::sort(lines.begin(), lines.end());
+    const std::vector<std::string> expected{"sketch.handle.count:1|c",
+                                            "sketch.handle.max:12|g",
+                                            "sketch.handle.p50:12|g",
+                                            "sketch.handle.p99.9:12|g",
+                                            "sketch.myTiming.count:1000|c|#foo",
+                                            "sketch.myTiming.max:1000|g|#foo",
+                                            "sketch.myTiming.p50:498|g|#foo",
+                                            "sketch.myTiming.p99.9:1000|g|#foo",
+                                            "sketch.threaded.count:1000|c",
+                                            "sketch.threaded.max:1000|g",
+                                            "sketch.threaded.p50:498|g",
+                                            "sketch.threaded.p99.9:1000|g"};
+    if (lines != expected) {
+        for (const auto& line : lines) {
+            std::cerr << line << std::endl;
+        }
+        throw std::runtime_error("Unexpected sketched timings");
+    }
+    client.increment("marker");
+    throwOnWrongMessage(server, "sketch.marker:1|c");
+}
+
+void testSetDeduplication() {
+    // The estimate is within a few standard errors
+    HyperLogLog estimate(12);
+    for (int i = 0; i < 100000; ++i) {
+        estimate.add(HyperLogLog::hash(std::to_string(i)));
+        estimate.add(HyperLogLog::hash(std::to_string(i / 2)));
+    }
+    if (std::fabs(estimate.estimate() - 100000) > 5000) {
+        std::cerr << "Estimated " << estimate.estimate() << " distinct values out of 100000" << std::endl;
+        throw std::runtime_error("Inaccurate cardinality estimate");
+    }
+
+    // Estimates merge as if the values had been added to a single one
+    HyperLogLog evens(12), odds(12);
+    for (int i = 0; i < 100000; ++i) {
+        (i % 2 == 0 ? evens : odds).add(HyperLogLog::hash(std::to_string(i)));
+    }
+    evens.merge(odds);
+    if (std::fabs(evens.estimate() - 100000) > 5000) {
+        std::cerr << "Estimated " << evens.estimate() << " distinct values out of 100000" << std::endl;
+        throw std::runtime_error("Inaccurate merged cardinality estimate");
+    }
+
+    // The client emits small sets member by member and larger ones as an estimate
+    StatsdServer server;
+    throwOnError(server);
+    ClientOptions options;
+    options.dedupSets = true;
+    options.sets.exactThreshold = 10;
+    StatsdClient client("localhost", 8125, "sets", 0, 0, 0, options);
+    const auto handle = client.metric("handle", "s");
+    for (unsigned int i = 0; i < 1000; ++i) {
+        client.set("small", i % 3, 0.01f, {"foo"});
+        client.set("large", i % 100);
+        handle.record(i % 2);
+    }
+
+    // Threads deduplicate apart, their members being joined at the flush, and estimated past the threshold
+    std::vector<std::thread> threads;
+    for (unsigned int t = 0; t < 4; ++t) {
+        threads.emplace_back([&client, t] {
+            for (unsigned int i = 0; i < 50; ++i) {
+                client.set("shared", i % 3);
+                client.set("spread", 50 * t + i);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    // Nothing is deduplicated at a frequency of 0, like nothing is sent without deduplication
+    client.set("never", 1, 0.f);
+    client.flush();
+    std::vector<std::string> lines;
+    for (int i = 0; i < 10; ++i) {
+        lines.push_back(server.receive());
+    }
+    std::sort(lines.begin(), lines.end());
+    for (const auto& estimated : {std::make_pair(std::string("sets.large.cardinality:"), 100),
+                                  std::make_pair(std::string("sets.spread.cardinality:"), 200)}) {
+        const auto& prefix = estimated.first;
+        const auto large = std::find_if(lines.begin(), lines.end(), [&prefix](const std::string& line) {
+            return line.compare(0, prefix.size(), prefix) == 0;
+        });
+        if (large == lines.end() ||
+            std::abs(std::stoi(large->substr(prefix.size())) - estimated.second) > estimated.second / 20) {
+            throw std::runtime_error("Expected an estimate of the set " + prefix);
+        }
+        lines.erase(large);
+    }
+    const std::vector<std::string> expected{"sets.handle:0|s",
+                                            "sets.handle:1|s",
+                                            "sets.shared:0|s",
+                                            "sets.shared:1|s",
+                                            "sets.shared:2|s",
+                                            "sets.small:0|s|#foo",
+                                            "sets.small:1|s|#foo",
+                                            "sets.small:2|s|#foo"};
+    if (lines != expected) {
+        for (const auto& line : lines) {
+            std::cerr << line << std::endl;
+        }
+        throw std::runtime_error("Unexpected deduplicated sets");
+    }
+    client.increment("marker");
+    throwOnWrongMessage(server, "sets.marker:1|c");
+}
+
+void testBatchErrors() {
+    StatsdServer server;
+    throwOnError(server);
+
+    // A metric too large for a datagram is dropped and reported, the metrics around it still go through
+    StatsdClient client("localhost", 8125, "errors", 8, 0);
+    client.increment("before");
+    client.increment(std::string(70000, 'x'));
+    throwOnError(client, false, "Sending an oversized metric should have failed");
+    client.increment("after");
+    client.flush();
+    const auto stats = client.stats();
+    if (stats.oversizedMessages != 1 || stats.droppedMessages != 1 || !stats.sendFailures.empty()) {
+        throw std::runtime_error("Oversized metrics should be counted as dropped");
+    }
+    throwOnWrongMessage(server, "errors.before:1|c");
+    throwOnWrongMessage(server, "errors.after:1|c");
+}
+
+void testPacking() {
+    StatsdServer server;
+    throwOnError(server);
+
+    // Batches are closed before a metric would take them over the batch size, "pack.mN:1|c" being 11 bytes long
+    ClientOptions options;
+    options.sender.maxDatagramSize = 30;
+    StatsdClient client("localhost", 8125, "pack", 40, 0, 4, options);
+    for (int i = 0; i < 5; ++i) {
+        client.increment("m" + std::to_string(i));
+    }
+
+    // Nor do they grow beyond the maximum datagram size, a metric larger than it being dropped
+    client.increment(std::string(25, 'x'));
+    client.increment("last");
+    client.flush();
+    throwOnWrongMessage(server, "pack.m0:1|c\npack.m1:1|c");
+    throwOnWrongMessage(server, "pack.m2:1|c\npack.m3:1|c");
+    throwOnWrongMessage(server, "pack.m4:1|c\npack.last:1|c");
+    if (client.stats().oversizedMessages != 1) {
+        throw std::runtime_error("The metric larger than a datagram should have been dropped");
+    }
+
+    // The maximum datagram size follows the route to the daemon by default
+    client.setConfig("localhost", 8125, "pack", 40, 0);
+    for (int i = 0; i < 4; ++i) {
+        client.increment("m" + std::to_string(i));
+    }
+    client.flush();
+    throwOnWrongMessage(server, "pack.m0:1|c\npack.m1:1|c\npack.m2:1|c");
+    throwOnWrongMessage(server, "pack.m3:1|c");
+}
+
+void testUnixSocket() {
+#ifndef _WIN32
+    const std::string path = "/tmp/cpp-statsd-client-test-" + std::to_string(getpid()) + ".sock";
+    StatsdServer server(path);
+    throwOnError(server);
+
+    // Metrics go to the daemon over a Unix domain socket, batched or not, the port being ignored
+    StatsdClient client("unix://" + path, 0, "unix", 0, 0);
+    throwOnError(client);
+    client.increment("single");
+    throwOnWrongMessage(server, "unix.single:1|c");
+    client.setConfig("unix://" + path, 0, "unix", 64, 0);
+    client.increment("first");
+    client.increment("second");
+    client.flush();
+    throwOnWrongMessage(server, "unix.first:1|c\nunix.second:1|c");
+
+    // A full daemon buffer fails the datagrams right away rather than blocking, and is reported
+    client.setConfig("unix://" + path, 0, "unix", 0, 0);
+    for (int i = 0; i < 10000 && client.errorMessage().empty(); ++i) {
+        client.increment("flood");
+    }
+    throwOnError(client, false, "Filling the buffer of the daemon should have failed");
+    if (client.errorMessage().find("full") == std::string::npos || client.stats().sendFailures.count(EAGAIN) == 0) {
+        throw std::runtime_error("A full buffer should be reported: " + client.errorMessage());
+    }
+
+    // A path too long for a socket address is an error
+    StatsdClient invalid("unix://" + std::string(200, 'x'), 0, "unix");
+    throwOnError(invalid, false, "Should not be able to use an invalid socket path");
+#endif
+}
+
+void testTcp() {
+    ClientOptions options;
+    options.sender.reconnectBackoff = 1;
+    options.sender.maxReconnectBackoff = 1;
+    std::unique_ptr<StatsdTcpServer> server(new StatsdTcpServer(8127));
+    throwOnError(*server);
+
+    // Batches are written to the connection, each newline terminated
+    StatsdClient client("tcp://localhost", 8127, "tcp", 64, 0, 4, options);
+    throwOnError(client);
+    client.increment("first");
+    client.increment("second");
+    client.flush();
+    std::string expected = "tcp.first:1|c\ntcp.second:1|c\n";
+    if (server->receive(expected.size()) != expected) {
+        throw std::runtime_error("Incorrect batch received over TCP");
+    }
+
+    // The daemon being gone is noticed once a write fails, the metrics then wait in the queue
+    server.reset();
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        client.increment("while.away");
+        client.flush();
+        if (!client.errorMessage().empty()) {
+            break;
+        }
+    }
+    throwOnError(client, false, "Reconnecting to a daemon which is gone should have failed");
+
+    // Once it is back, they are written to a new connection
+    server.reset(new StatsdTcpServer(8127));
+    throwOnError(*server);
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    client.flush();
+    expected = "tcp.while.away:1|c\n";
+    if (server->receive(expected.size()) != expected || client.stats().droppedMessages != 0) {
+        throw std::runtime_error("The metrics queued while disconnected should have been written once reconnected");
+    }
+
+    // Without batching every metric is written on its own
+    server.reset();
+    server.reset(new StatsdTcpServer(8127));
+    throwOnError(*server);
+    client.setConfig("tcp://localhost", 8127, "tcp", 0, 0, 4, options);
+    client.increment("single");
+    expected = "tcp.single:1|c\n";
+    if (server->receive(expected.size()) != expected) {
+        throw std::runtime_error("Incorrect metric received over TCP");
+    }
+}
+
+void testIoUring() {
+    StatsdServer server;
+    throwOnError(server);
+
+    // Batches submitted to an io_uring arrive like the others, syscalls taking over where it is unavailable
+    SenderOptions options;
+    options.ioUring = true;
+    options.batchesPerSyscall = 4;
+    {
+        UDPSender sender("localhost", 8125, 32, 0, options);
+        throwOnError(sender);
+        for (int i = 0; i < 3; ++i) {
+            sender.send("uring.m" + std::to_string(i) + ":1|c");
+        }
+        sender.send("uring." + std::string(30, 'x') + ":1|c");
+        sender.flush();
+        throwOnWrongMessage(server, "uring.m0:1|c\nuring.m1:1|c");
+        throwOnWrongMessage(server, "uring.m2:1|c");
+        throwOnWrongMessage(server, "uring." + std::string(30, 'x') + ":1|c");
+
+        // More batches than there are slots for
+        for (int i = 0; i < 100; ++i) {
+            sender.send("uring.many:1|c");
+        }
+        sender.flush();
+        for (int i = 0; i < 50; ++i) {
+            throwOnWrongMessage(server, "uring.many:1|c\nuring.many:1|c");
+        }
+    }
+
+    // Only UDP goes through it
+    UDPSender unix("unix:///tmp/cpp-statsd-client-test-uring.sock", 0, 32, 0, options);
+    if (unix.usesIoUring()) {
+        throw std::runtime_error("Only UDP should use io_uring");
+    }
+}
+
+void sendViews(const StatsdClient& client) {
+    static const char key[] = "some.key.with.a.suffix";
+    static const std::vector<std::string> tags{"foo:1", "bar:2"};
+    static const StringView viewTags[] = {"foo:1", StringView(key, 4)};
+    client.increment("literal", 1.f, {"foo:1", "bar:2"});
+    client.count(StringView(key, 8), 3, 1.f, tags);
+    client.gauge(std::string("string"), 3.5, 1.f, TagsView(viewTags, 2));
+    client.timing("joined", 12, 1.f, TagsView::joined("foo:1,bar:2"));
+    client.set("untagged", 7);
+}
+
+// Metrics defined at compile time, spelled the way C++11 allows
+STATSD_METRIC(DbQuery, "db.query", metric::Timing, "shard:1,db:main");
+STATSD_METRIC(Requests, "requests", metric::Count, "");
+struct Distribution {
+    static constexpr const char* symbol() noexcept {
+        return "d";
+    }
+};
+STATSD_METRIC(Payload, "payload", Distribution, "");
+
+void testDefinitions() {
+    StatsdServer server;
+    throwOnError(server);
+
+    // The line is laid out by the compiler, only the prefix and the value are added
+    static_assert(detail::MetricLayout<DbQuery>::suffixLength == std::strlen("|ms|#shard:1,db:main"),
+                  "The suffix should hold the type and the tags");
+    StatsdClient client("localhost", 8125, "defined");
+    client.record<DbQuery>(12.5);
+    throwOnWrongMessage(server, "defined.db.query:12.5000|ms|#shard:1,db:main");
+    client.record<Requests>(3);
+    throwOnWrongMessage(server, "defined.requests:3|c");
+    client.record<Payload>(512);
+    throwOnWrongMessage(server, "defined.payload:512|d");
+
+    // They are recorded like the other metrics of their type, e.g. aggregated
+    ClientOptions options;
+    options.aggregate = true;
+    client.setConfig("localhost", 8125, "defined", 0, 0, 4, options);
+    client.record<Requests>(1);
+    client.record<Requests>(2);
+    client.flush();
+    throwOnWrongMessage(server, "defined.requests:3|c");
+}
+
+void testTimers() {
+    StatsdServer server;
+    throwOnError(server);
+
+    // The tick clock measures at least the time slept, and not much more however loaded the machine is
+    detail::TickClock::calibrate();
+    const uint64_t start = detail::TickClock::now();
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    const double ticked = detail::TickClock::milliseconds(detail::TickClock::now() - start);
+    if (ticked < 4.9 || ticked > 50) {
+        throw std::runtime_error("The tick clock should measure about 5 ms, not " + std::to_string(ticked) + " ms");
+    }
+
+    // Durations are recorded in fractional milliseconds
+    StatsdClient client("localhost", 8125, "timed");
+    client.timing("duration", std::chrono::microseconds(1500));
+    throwOnWrongMessage(server, "timed.duration:1.5000|ms");
+
+    // A scope is recorded when the timer is destroyed
+    {
+        const auto timer = client.time("scope", 1.f, {"route:/api"});
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    const auto recorded = server.receive();
+    const auto colon = recorded.find(':');
+    const auto bar = recorded.find('|');
+    if (recorded.compare(0, colon, "timed.scope") != 0 || recorded.substr(bar) != "|ms|#route:/api" ||
+        std::stod(recorded.substr(colon + 1, bar - colon - 1)) < 2) {
+        throw std::runtime_error("Unexpected scope timing: " + recorded);
+    }
+
+    // Nothing is recorded by a cancelled timer, nor by one which is not sampled, nor twice by a stopped one
+    {
+        auto cancelled = client.time("cancelled");
+        cancelled.cancel();
+        const auto unsampled = client.time("unsampled", 0.f);
+        auto stopped = client.time<DbQuery>();
+        stopped.stop();
+    }
+    const auto stopped = server.receive();
+    if (stopped.compare(0, std::strlen("timed.db.query:"), "timed.db.query:") != 0) {
+        throw std::runtime_error("Only the stopped timer should have been recorded: " + stopped);
+    }
+    client.increment("marker");
+    throwOnWrongMessage(server, "timed.marker:1|c");
+
+    // A timer started for sketches is sampled when it stops if the configuration no longer sketches
+    ClientOptions options;
+    options.sketchTimings = true;
+    client.setConfig("localhost", 8125, "timed", 0, 0, 4, options);
+    {
+        const auto unsampled = client.time("unsampled", 0.f);
+        client.setConfig("localhost", 8125, "timed");
+    }
+    client.increment("marker");
+    throwOnWrongMessage(server, "timed.marker:1|c");
+}
+
+void testConstantTags() {
+    StatsdServer server;
+    throwOnError(server);
+
+    // The constant tags follow the tags of the metric, if any, and the sample rate
+    ClientOptions options;
+    options.constantTags = {"host:web-1", "env:prod"};
+    StatsdClient client("localhost", 8125, "constant", 0, 0, 4, options);
+    client.increment("plain");
+    throwOnWrongMessage(server, "constant.plain:1|c|#host:web-1,env:prod");
+    client.gauge("tagged", 2, 1.f, {"route:/api"});
+    throwOnWrongMessage(server, "constant.tagged:2|g|#route:/api,host:web-1,env:prod");
+    client.seed(9);
+    client.count("sampled", 2, 0.1f);
+    throwOnWrongMessage(server, "constant.sampled:2|c|@0.1|#host:web-1,env:prod");
+    client.record<DbQuery>(3);
+    throwOnWrongMessage(server, "constant.db.query:3|ms|#shard:1,db:main,host:web-1,env:prod");
+
+    // The aggregates carry them too
+    options.aggregate = true;
+    client.setConfig("localhost", 8125, "constant", 0, 0, 4, options);
+    client.increment("aggregated");
+    client.increment("aggregated");
+    client.flush();
+    throwOnWrongMessage(server, "constant.aggregated:2|c|#host:web-1,env:prod");
+
+    // And they change with the configuration
+    client.setConfig("localhost", 8125, "constant");
+    client.increment("plain");
+    throwOnWrongMessage(server, "constant.plain:1|c");
+}
+
+void testValuePacking() {
+    StatsdServer server;
+    throwOnError(server);
+
+    // The values of a timing wait for the flush and go out together, the other types as usual
+    ClientOptions options;
+    options.packValues = true;
+    StatsdClient client("localhost", 8125, "vp", 0, 0, 4, options);
+    client.timing("t", 1, 1.f, {"a:1"});
+    client.timing("t", 2, 1.f, {"a:1"});
+    client.increment("c");
+    throwOnWrongMessage(server, "vp.c:1|c");
+    client.timing("t", 3, 1.f, {"a:1"});
+    client.flush();
+    throwOnWrongMessage(server, "vp.t:1:2:3|ms|#a:1");
+
+    // Distributions pack too, the sample rate applying to every value of the line
+    client.seed(3);
+    client.custom("d", 0.5, "d");
+    client.custom("d", 1.5, "d");
+    client.flush();
+    throwOnWrongMessage(server, "vp.d:0.5000:1.5000|d");
+    for (int i = 0; i < 200; ++i) {
+        client.timing("sampled", 7, 0.5f);
+    }
+    client.flush();
+    const auto sampled = server.receive();
+    if (sampled.find("vp.sampled:7:7:") != 0 || sampled.find("|ms|@0.5") != sampled.size() - 8) {
+        throw std::runtime_error("Sampled values should be packed with their rate, got " + sampled);
+    }
+
+    // Threads pack apart, their values being joined on one line at the flush
+    std::vector<std::thread> threads;
+    for (unsigned int t = 0; t < 4; ++t) {
+        threads.emplace_back([&client, t] { client.timing("threads", t); });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    client.flush();
+    const auto joined = server.receive();
+    const auto values = joined.substr(std::strlen("vp.threads"), joined.find('|') - std::strlen("vp.threads"));
+    std::vector<std::string> split;
+    for (std::size_t colon = 0; colon != std::string::npos; colon = values.find(':', colon + 1)) {
+        split.push_back(values.substr(colon + 1, values.find(':', colon + 1) - colon - 1));
+    }
+    std::sort(split.begin(), split.end());
+    if (joined.compare(0, std::strlen("vp.threads:"), "vp.threads:") != 0 ||
+        split != std::vector<std::string>{"0", "1", "2", "3"}) {
+        throw std::runtime_error("The values of the threads should be joined, got " + joined);
+    }
+
+    // A line is sent as soon as the next value would not fit in a datagram, "vp.t:1:2:3|ms" being 14 bytes long
+    options.sender.maxDatagramSize = 14;
+    client.setConfig("localhost", 8125, "vp", 0, 0, 4, options);
+    for (unsigned int i = 1; i <= 4; ++i) {
+        client.timing("t", i);
+    }
+    throwOnWrongMessage(server, "vp.t:1:2:3|ms");
+    client.flush();
+    throwOnWrongMessage(server, "vp.t:4|ms");
+
+#ifndef _WIN32
+    // A Unix socket takes messages of any size without batching, so lines are capped at a typical datagram instead
+    const std::string path = "/tmp/cpp-statsd-client-test-vp-" + std::to_string(getpid()) + ".sock";
+    StatsdServer unixServer(path);
+    throwOnError(unixServer);
+    client.setConfig("unix://" + path, 0, "vp", 0, 0, 4, options);
+    for (int i = 0; i < 1000; ++i) {
+        client.timing("u", 1);
+    }
+    const auto early = unixServer.receive();
+    if (early.find("vp.u:1:1:") != 0 || early.size() > ValuePacker::k_unboundedLineLength ||
+        early.size() + 2 <= ValuePacker::k_unboundedLineLength) {
+        throw std::runtime_error("A packed line should be sent once it is full, got " + std::to_string(early.size()));
+    }
+    client.flush();
+#endif
+}
+
+void testViews() {
+    StatsdServer server;
+    throwOnError(server);
+
+    // Keys and tags bind to views of all kinds, which all make the same lines
+    StatsdClient client("localhost", 8125, "views", 0, 0, 1);
+    sendViews(client);
+    throwOnWrongMessage(server, "views.literal:1|c|#foo:1,bar:2");
+    throwOnWrongMessage(server, "views.some.key:3|c|#foo:1,bar:2");
+    throwOnWrongMessage(server, "views.string:3.5|g|#foo:1,some");
+    throwOnWrongMessage(server, "views.joined:12|ms|#foo:1,bar:2");
+    throwOnWrongMessage(server, "views.untagged:7|s");
+
+    // Once the buffers of the thread have grown, queuing a metric for batching does not allocate
+    StatsdClient batching("localhost", 8125, "views", 64 * 1024, 0, 1);
+    sendViews(batching);
+    batching.flush();
+    allocations = 0;
+    countingAllocations = true;
+    for (int i = 0; i < 100; ++i) {
+        sendViews(batching);
+    }
+    countingAllocations = false;
+    if (allocations != 0) {
+        std::cerr << "Allocated " << allocations << " times" << std::endl;
+        throw std::runtime_error("Sending metrics should not allocate");
+    }
+    batching.flush();
+}
+
+template <typename T>
+void throwOnWrongFormat(const T value, const int precision) {
+    std::stringstream expected;
+    expected << std::fixed << std::setprecision(precision) << value;
+    std::string actual;
+    detail::appendValue(actual, value, precision);
+    if (actual != expected.str()) {
+        std::cerr << "Expected: " << expected.str() << " but got: " << actual << std::endl;
+        throw std::runtime_error("Incorrect value formatting");
+    }
+}
+
+void testFormatting() {
+    // Integers whatever the precision
+    throwOnWrongFormat(0, 4);
+    throwOnWrongFormat(-42, 4);
+    throwOnWrongFormat(1227u, 0);
+    throwOnWrongFormat(std::numeric_limits<int64_t>::min(), 3);
+    throwOnWrongFormat(std::numeric_limits<uint64_t>::max(), 3);
+    throwOnWrongFormat(true, 3);
+
+    // Floating point numbers with a fixed precision
+    throwOnWrongFormat(-123.456789, 3);
+    throwOnWrongFormat(3.0, 4);
+    throwOnWrongFormat(2.5f, 0);
+    throwOnWrongFormat(0.001, 2);
+    throwOnWrongFormat(-0.0001, 3);
+    throwOnWrongFormat(123456789.987654321, 6);
+    throwOnWrongFormat(1e300, 2);
+    throwOnWrongFormat(std::numeric_limits<double>::infinity(), 2);
+    throwOnWrongFormat(0.1f, 2);
+    throwOnWrongFormat(0.95f, 2);
+
+    // Anything else goes through a stream
+    throwOnWrongFormat('x', 2);
+    throwOnWrongFormat(std::string("foo"), 2);
+}
+
+void throwOnWrongRate(const float rate, const std::string& expected) {
+    std::string actual;
+    detail::appendRate(actual, rate);
+    if (actual != expected) {
+        std::cerr << "Expected: " << expected << " but got: " << actual << std::endl;
+        throw std::runtime_error("Incorrect sample rate");
+    }
+}
+
+void testRates() {
+    // Sample rates keep the digits which tell the float apart, never rounding to 0 or 1
+    throwOnWrongRate(0.001f, "0.001");
+    throwOnWrongRate(0.004f, "0.004");
+    throwOnWrongRate(0.999f, "0.999");
+    throwOnWrongRate(0.995f, "0.995");
+    throwOnWrongRate(0.05f, "0.05");
+    throwOnWrongRate(0.5f, "0.5");
+    throwOnWrongRate(0.1f, "0.1");
+    throwOnWrongRate(0.123456789f, "0.12345679");
+    throwOnWrongRate(0.0001f, "0.0001");
+
+    // The rates go out that way
+    StatsdServer server;
+    throwOnError(server);
+    StatsdClient client("localhost", 8125, "rates");
+    for (const float rate : {0.001f, 0.999f, 0.05f}) {
+        std::string expected = "rates.hits:1|c|@";
+        detail::appendRate(expected, rate);
+        // Increment until one is sampled, which the stats tell without waiting on the server
+        const uint64_t sent = client.stats().metricsFormatted;
+        for (int i = 0; client.stats().metricsFormatted == sent && i < 1000000; ++i) {
+            client.increment("hits", rate);
+        }
+        throwOnWrongMessage(server, expected);
+    }
+}
+
+void testWakeUpAndDrain() {
+    StatsdServer server;
+    throwOnError(server);
+    ClientOptions options;
+    options.sender.highWaterMark = 256;
+
+    // Reaching the high-water mark sends the queue long before the interval elapses
+    {
+        StatsdClient client("localhost", 8125, "wakeUp", 64, 60000, 4, options);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));  // let the batching thread go to sleep
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < 16; ++i) {
+            client.increment("a.rather.long.metric.key");
+        }
+        auto received = server.receive();
+        if (std::chrono::steady_clock::now() - start > std::chrono::seconds(10)) {
+            throw std::runtime_error("The high-water mark should wake the batching thread up");
+        }
+
+        // The rest is sent on destruction at the latest
+        for (auto lines = std::count(received.begin(), received.end(), '\n') + 1; lines < 16; lines += 1) {
+            received = server.receive();
+            lines += std::count(received.begin(), received.end(), '\n');
+        }
+    }
+
+    // Whatever is left is sent on destruction rather than dropped, with or without a batching thread
+    {
+        StatsdClient client("localhost", 8125, "drained", 64, 0);
+        client.increment("manual");
+    }
+    throwOnWrongMessage(server, "drained.manual:1|c");
+    {
+        StatsdClient client("localhost", 8125, "drained", 64, 60000);
+        client.increment("threaded");
+    }
+    throwOnWrongMessage(server, "drained.threaded:1|c");
+}
+
+void testOverload(const OverloadPolicy policy) {
+    StatsdServer server;
+    throwOnError(server);
+
+    // Overflow a small queue, with a batching thread only when blocking
+    ClientOptions options;
+    options.sender.queueCapacity = 256;
+    options.sender.overloadPolicy = policy;
+    options.sender.blockTimeout = 5000;
+    options.sender.highWaterMark = 1024;
+    const uint64_t sendInterval = policy == OverloadPolicy::Block ? 60000 : 0;
+    std::vector<std::string> messages;
+    uint64_t dropped = 0;
+    {
+        StatsdClient client("localhost", 8125, "overload", 64, sendInterval, 4, options);
+        for (int i = 0; i < 100; ++i) {
+            client.increment("m" + std::to_string(i));
+        }
+        client.flush();
+        dropped = client.droppedMessages();
+        if (dropped != 0 && client.droppedBytes() < dropped) {
+            throw std::runtime_error("Dropped bytes should be counted");
+        }
+    }
+    StatsdClient("localhost", 8125, "").timing("DONE", 0);
+    mock(server, messages);
+
+    // Every message is either received or counted as dropped
+    if (messages.size() + dropped != 100) {
+        throw std::runtime_error("Received " + std::to_string(messages.size()) + " and dropped " +
+                                 std::to_string(dropped) + " out of 100 messages");
+    }
+    const bool keptFirst = messages.front() == "overload.m0:1|c";
+    const bool keptLast = messages.back() == "overload.m99:1|c";
+    if ((policy == OverloadPolicy::DropNewest && (dropped == 0 || !keptFirst || keptLast)) ||
+        (policy == OverloadPolicy::DropOldest && (dropped == 0 || keptFirst || !keptLast)) ||
+        (policy == OverloadPolicy::Block && dropped != 0)) {
+        throw std::runtime_error("Unexpected messages dropped by the overload policy");
+    }
+}
+
+void testStats() {
+    StatsdServer server;
+    throwOnError(server);
+
+    // The counters follow what the client goes through
+    ClientOptions options;
+    options.emitStats = true;
+    std::vector<std::string> messages;
+    {
+        StatsdClient client("localhost", 8125, "stats", 64, 0, 4, options);
+        for (int i = 0; i < 10; ++i) {
+            client.increment("coco");
+        }
+        client.flush();
+        const auto stats = client.stats();
+        const auto flushes = std::accumulate(stats.flushDurations.begin(), stats.flushDurations.end(), uint64_t{0});
+        if (stats.metricsFormatted < 10 || stats.bytesQueued == 0 || stats.datagramsSent == 0 ||
+            stats.queueHighWaterMark == 0 || flushes == 0 || !stats.sendFailures.empty() ||
+            stats.droppedMessages != 0) {
+            throw std::runtime_error("Unexpected stats");
+        }
+    }
+    StatsdClient("localhost", 8125, "").timing("DONE", 0);
+    mock(server, messages);
+
+    // They are emitted under the reserved prefix at every flush, as the increase since the previous one
+    for (const auto& expected : {"statsd.client.metrics_formatted:10|c", "statsd.client.queue_high_water_mark:"}) {
+        if (std::none_of(messages.begin(), messages.end(), [expected](const std::string& message) {
+                return message.compare(0, std::strlen(expected), expected) == 0;
+            })) {
+            throw std::runtime_error(std::string("Expected stats line: ") + expected);
+        }
+    }
+}
+
+void testShards(const bool threadPerShard) {
+    StatsdServer server;
+    throwOnError(server);
+    std::vector<std::string> messages;
+    std::thread receiver(mock, std::ref(server), std::ref(messages));
+
+    // Threads spread their metrics over the shards, which are all flushed every interval
+    ClientOptions options;
+    options.shards = 4;
+    options.threadPerShard = threadPerShard;
+    StatsdClient client("localhost", 8125, "shards", 64, 20, 4, options);
+    throwOnError(client);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; ++t) {
+        threads.emplace_back([&client, t] {
+            for (int i = 0; i < 25; ++i) {
+                client.increment("thread" + std::to_string(t));
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    StatsdClient("localhost", 8125, "").timing("DONE", 0);
+    receiver.join();
+
+    std::map<std::string, int> received;
+    for (const auto& message : messages) {
+        ++received[message];
+    }
+    for (int t = 0; t < 8; ++t) {
+        if (received["shards.thread" + std::to_string(t) + ":1|c"] != 25) {
+            throw std::runtime_error("Every metric should have been flushed by the shards");
+        }
+    }
+    if (client.stats().metricsFormatted != 200) {
+        throw std::runtime_error("The stats should add the shards up");
+    }
+}
+
+void testLocalBatches() {
+    StatsdServer server;
+    throwOnError(server);
+
+    // A thread queues its batch once the next metric would not fit, the flush collects the partial one
+    ClientOptions options;
+    options.sender.threadLocalBatches = true;
+    StatsdClient client("localhost", 8125, "local", 40, 0, 4, options);
+    for (int i = 0; i < 4; ++i) {
+        client.increment("m" + std::to_string(i));
+    }
+    client.flush();
+    throwOnWrongMessage(server, "local.m0:1|c\nlocal.m1:1|c\nlocal.m2:1|c");
+    throwOnWrongMessage(server, "local.m3:1|c");
+
+    // The batch of a thread which is gone is collected all the same
+    std::thread([&client] { client.increment("gone"); }).join();
+    client.flush();
+    throwOnWrongMessage(server, "local.gone:1|c");
+
+    // With a batching thread, the partial batches of busy threads go out within the interval
+    std::vector<std::string> messages;
+    std::thread receiver(mock, std::ref(server), std::ref(messages));
+    client.setConfig("localhost", 8125, "local", 64, 20, 4, options);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&client, t] {
+            for (int i = 0; i < 25; ++i) {
+                client.increment("thread" + std::to_string(t));
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    StatsdClient("localhost", 8125, "").timing("DONE", 0);
+    receiver.join();
+
+    std::map<std::string, int> received;
+    for (const auto& message : messages) {
+        ++received[message];
+    }
+    for (int t = 0; t < 4; ++t) {
+        if (received["local.thread" + std::to_string(t) + ":1|c"] != 25) {
+            throw std::runtime_error("Every metric should have been collected from the threads");
+        }
+    }
+    if (client.stats().metricsFormatted != 100) {
+        throw std::runtime_error("The metrics should be counted once queued");
+    }
 }
 
 void testReconfigure() {
@@ -72,8 +1091,66 @@ void testReconfigure() {
     client.increment("");
     throwOnWrongMessage(server, ":1|c");
 
-    // TODO: test what happens with the batching after resolving the question about incomplete
-    //  batches being dropped vs sent on reconfiguring
+    // The batches queued under a configuration are drained when it is replaced, even under load
+    std::vector<std::string> messages;
+    std::thread receiver(mock, std::ref(server), std::ref(messages));
+    client.setConfig("localhost", 8125, "live", 64, 1000);
+    std::atomic<bool> done{false};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&client] {
+            for (int i = 0; i < 250; ++i) {
+                client.increment("requests");
+            }
+        });
+    }
+    std::thread reconfigurer([&client, &done] {
+        for (uint64_t i = 0; !done.load(); ++i) {
+            client.setConfig("localhost", 8125, "live", i % 2 == 0 ? 0 : 64, i % 3 == 0 ? 0 : 1000);
+        }
+    });
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    done.store(true);
+    reconfigurer.join();
+    client.flush();
+    StatsdClient("localhost", 8125, "").timing("DONE", 0);
+    receiver.join();
+
+    const auto received = std::count(messages.begin(), messages.end(), "live.requests:1|c");
+    if (received != 1000) {
+        throw std::runtime_error("Reconfiguring should not lose any metric, received " + std::to_string(received));
+    }
+}
+
+void testHandles() {
+    StatsdServer server;
+    throwOnError(server);
+
+    StatsdClient client("localhost", 8125, "first");
+    const auto counter = client.counter("requests", {"route:/api"});
+    const auto gauge = client.metric("titi", "g", {"foo", "bar"});
+    const auto timing = client.metric("myTiming", "ms");
+
+    counter.increment();
+    throwOnWrongMessage(server, "first.requests:1|c|#route:/api");
+
+    // The sample rate goes between the type and the tags
+    client.seed(9);
+    counter.count(2, 0.1f);
+    throwOnWrongMessage(server, "first.requests:2|c|@0.1|#route:/api");
+
+    gauge.record(2.5);
+    throwOnWrongMessage(server, "first.titi:2.5000|g|#foo,bar");
+
+    timing.record(42u);
+    throwOnWrongMessage(server, "first.myTiming:42|ms");
+
+    // Handles follow the configuration of the client
+    client.setConfig("localhost", 8125, "second");
+    counter.decrement();
+    throwOnWrongMessage(server, "second.requests:-1|c|#route:/api");
 }
 
 void testSendRecv(uint64_t batchSize, uint64_t sendInterval) {
@@ -100,10 +1177,10 @@ void testSendRecv(uint64_t batchSize, uint64_t sendInterval) {
         expected.emplace_back("sendRecv.kiki:-1|c");
 
         // Adjusts "toto" by +2
-        client.seed(19);  // this seed gets a hit on the first call
+        client.seed(9);  // this seed gets a hit on the first call
         client.count("toto", 2, 0.1f);
         throwOnError(client);
-        expected.emplace_back("sendRecv.toto:2|c|@0.10");
+        expected.emplace_back("sendRecv.toto:2|c|@0.1");
 
         // Gets "sampled out" by the random number generator
         client.count("popo", 9, 0.1f);
@@ -120,10 +1197,10 @@ void testSendRecv(uint64_t batchSize, uint64_t sendInterval) {
         expected.emplace_back("sendRecv.titifloat:-123.457|g");
 
         // Record a timing of 2ms for "myTiming"
-        client.seed(19);
+        client.seed(9);
         client.timing("myTiming", 2, 0.1f);
         throwOnError(client);
-        expected.emplace_back("sendRecv.myTiming:2|ms|@0.10");
+        expected.emplace_back("sendRecv.myTiming:2|ms|@0.1");
 
         // Send a set with 1227 total uniques
         client.set("tutu", 1227, 2.0f);
@@ -138,7 +1215,7 @@ void testSendRecv(uint64_t batchSize, uint64_t sendInterval) {
         // All the things
         client.count("foo", -42, .9f, {"bar", "baz"});
         throwOnError(client);
-        expected.emplace_back("sendRecv.foo:-42|c|@0.90|#bar,baz");
+        expected.emplace_back("sendRecv.foo:-42|c|@0.9|#bar,baz");
 
         // Custom metric type should pass through all params
         client.custom("custom_metric_type", 5678, "cust", .95f, {"tag1", "tag2"});
@@ -171,19 +1248,163 @@ void testSendRecv(uint64_t batchSize, uint64_t sendInterval) {
     }
 }
 
+void testAggregation(uint64_t batchSize, uint64_t sendInterval) {
+    StatsdServer mock_server;
+    std::vector<std::string> messages, expected;
+    std::thread server(mock, std::ref(mock_server), std::ref(messages));
+
+    ClientOptions options;
+    options.aggregate = true;
+    {
+        StatsdClient client("localhost", 8125, "aggregate.", batchSize, sendInterval, 3, options);
+        throwOnError(client);
+
+        // Counters are summed regardless of the sampling frequency
+        for (int i = 0; i < 1000; ++i) {
+            client.increment("coco");
+            client.count("toto", 2, 0.1f, {"foo"});
+        }
+        client.decrement("coco");
+        expected.emplace_back("aggregate.coco:999|c");
+        expected.emplace_back("aggregate.toto:2000|c|#foo");
+
+        // Counters with different tags are kept apart
+        client.count("toto", 5, 1.f, {"bar"});
+        expected.emplace_back("aggregate.toto:5|c|#bar");
+
+        // Gauges keep the last value
+        client.gauge("titi", 1);
+        client.gauge("titi", 2.5);
+        expected.emplace_back("aggregate.titi:2.500|g");
+
+        // Threads aggregate apart, their counts adding up and the gauge written last winning
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&client] {
+                for (int i = 0; i < 250; ++i) {
+                    client.increment("shared");
+                }
+                client.gauge("last", 1);
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        client.gauge("last", 2);
+        expected.emplace_back("aggregate.shared:1000|c");
+        expected.emplace_back("aggregate.last:2|g");
+
+        // Nothing is aggregated at a frequency of 0, like nothing is sent without aggregation
+        client.increment("never", 0.f);
+        client.gauge("never", 1, 0.f);
+
+        // Other types pass through
+        client.timing("myTiming", 2);
+        expected.emplace_back("aggregate.myTiming:2|ms");
+
+        // The aggregates are emitted when flushing, the client destruction flushes as well
+        if (sendInterval == 0) {
+            client.flush();
+        }
+    }
+
+    // Signal the mock server we are done
+    StatsdClient("localhost", 8125, "").timing("DONE", 0);
+    server.join();
+
+    // The batching thread may have flushed part of the counts early, add them up
+    std::vector<std::string> merged;
+    std::map<std::string, long long> counts;
+    for (const auto& message : messages) {
+        const auto colon = message.find(':');
+        const auto pipe = message.find('|');
+        if (message.compare(pipe, 2, "|c") == 0) {
+            counts[message.substr(0, colon) + message.substr(pipe)] += std::stoll(message.substr(colon + 1));
+        } else {
+            merged.push_back(message);
+        }
+    }
+    for (const auto& count : counts) {
+        const auto pipe = count.first.find('|');
+        merged.push_back(count.first.substr(0, pipe) + ":" + std::to_string(count.second) + count.first.substr(pipe));
+    }
+    messages.swap(merged);
+
+    // The aggregates come out in no particular order
+    std::sort(messages.begin(), messages.end());
+    std::sort(expected.begin(), expected.end());
+    if (messages != expected) {
+        std::cerr << "Unexpected aggregated stats received by server, got:" << std::endl;
+        for (const auto& message : messages) {
+            std::cerr << message << std::endl;
+        }
+        throw std::runtime_error("Unexpected aggregated stats");
+    }
+}
+
 int main() {
     // If any of these tests fail they throw an exception, not catching makes for a nonzero return code
 
     // general things that should be errors
     testErrorConditions();
+    // formatting of the values
+    testFormatting();
+    testRates();
+    // the lock-free queue used for batching
+    testRingBuffer();
+    // the per-thread sampling generators
+    testSampling();
+    // the timing sketches
+    testSketches();
+    // the deduplication of sets
+    testSetDeduplication();
+    // failures while sending batches
+    testBatchErrors();
+    // packing metrics into datagrams
+    testPacking();
+    // sending through io_uring
+    testIoUring();
+    // sending over a unix domain socket
+    testUnixSocket();
+    // sending over a tcp connection
+    testTcp();
+    // waking the batching thread up and draining the queue on destruction
+    testWakeUpAndDrain();
+    // overflowing the queue
+    testOverload(OverloadPolicy::DropNewest);
+    testOverload(OverloadPolicy::DropOldest);
+    testOverload(OverloadPolicy::Block);
+    // the stats of the client itself
+    testStats();
+    // spreading the metrics over shards
+    testShards(true);
+    testShards(false);
+    // batching in the producer threads
+    testLocalBatches();
     // reconfiguring how you are sending
     testReconfigure();
+    // pre-registered metrics
+    testHandles();
+    // keys and tags given as views
+    testViews();
+    // metrics defined at compile time
+    testDefinitions();
+    // timing scopes
+    testTimers();
+    // tags added to every metric
+    testConstantTags();
+    // multiple values per line
+    testValuePacking();
     // no batching
     testSendRecv(0, 0);
     // background batching
     testSendRecv(32, 1000);
     // manual flushing of batches
     testSendRecv(16, 0);
+    // aggregation of counters and gauges
+    testAggregation(0, 0);
+    testAggregation(64, 1000);
+    testAggregation(64, 0);
 
     return EXIT_SUCCESS;
 }